@@ -1,23 +1,94 @@
 #include "Buffer.h"
+#include "ChunkPool.h"
+
+#include <algorithm>
 
 #include <errno.h>
 #include <sys/uio.h>
 
 using namespace buzz;
 
-ssize_t Buffer::ReadFd(int fd, int* err_code)
+const size_t Buffer::kInitialSize;
+const size_t Buffer::kMaxReadHint;
+const size_t ReadScratch::kSize;
+
+Buffer::Buffer(const Buffer& rhs)
+    : m_pool(rhs.m_pool),
+    m_data(EmptyStorage()),
+    m_capacity(kCheapPrepend),
+    m_reader_index(kCheapPrepend),
+    m_writer_index(kCheapPrepend),
+    m_read_hint(rhs.m_read_hint),
+    m_small_reads(0)
+{
+    if (rhs.ReadableBytes() > 0) {
+        Append(rhs.Peek(), rhs.ReadableBytes());
+    }
+}
+
+Buffer::Buffer(Buffer&& rhs)
+    : m_pool(rhs.m_pool),
+    m_data(rhs.m_data),
+    m_capacity(rhs.m_capacity),
+    m_reader_index(rhs.m_reader_index),
+    m_writer_index(rhs.m_writer_index),
+    m_read_hint(rhs.m_read_hint),
+    m_small_reads(rhs.m_small_reads)
+{
+    rhs.m_data = EmptyStorage();
+    rhs.m_capacity = kCheapPrepend;
+    rhs.RetrieveAll();
+}
+
+void Buffer::Reallocate(size_t writable)
+{
+    const size_t readable = ReadableBytes();
+    const size_t size = kCheapPrepend + readable + writable;
+
+    size_t capacity = size;
+    char* data = m_pool ? m_pool->Allocate(size, &capacity) : new char[size];
+
+    std::copy(Peek(), Peek() + readable, data + kCheapPrepend);
+    FreeStorage();
+
+    m_data = data;
+    m_capacity = capacity;
+    m_reader_index = kCheapPrepend;
+    m_writer_index = kCheapPrepend + readable;
+}
+
+void Buffer::FreeStorage()
+{
+    if (HasStorage() == false) return;
+
+    if (m_pool) {
+        m_pool->Free(m_data, m_capacity);
+    } else {
+        delete[] m_data;
+    }
+}
+
+ssize_t Buffer::ReadFd(int fd, int* err_code, ReadScratch* scratch, size_t max_bytes)
 {
-    char extrabuf[65536];
+    if (scratch == NULL) {
+        static thread_local ReadScratch t_scratch;
+        scratch = &t_scratch;
+    }
+
+    EnsureWritableBytes(std::min(m_read_hint, max_bytes));
+
     struct iovec vec[2];
 
-    const size_t writable = WritableBytes();
+    const size_t space = WritableBytes();
+    const size_t writable = std::min(space, max_bytes);
+    const size_t overflow = std::min(ReadScratch::kSize, max_bytes - writable);
     
     vec[0].iov_base = Begin() + m_writer_index;
     vec[0].iov_len  = writable;
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len  = sizeof(extrabuf);
+    vec[1].iov_base = scratch->Data();
+    vec[1].iov_len  = overflow;
 
-    const int iov_cnt = (writable < sizeof(extrabuf)) ? 2 : 1;
+    const int iov_cnt = (writable < ReadScratch::kSize && overflow > 0) ? 2 : 1;
 
     const ssize_t n = ::readv(fd, vec, iov_cnt);
     
@@ -25,10 +96,33 @@ ssize_t Buffer::ReadFd(int fd, int* err_code)
         *err_code = errno;
     } else if (static_cast<size_t>(n) <= writable) {
         m_writer_index += n;
+        scratch->Count(n, 0);
     } else {
-        m_writer_index = m_buffer.size();
-        Append(extrabuf, n - writable);
+        m_writer_index += writable;
+        Append(scratch->Data(), n - writable);
+        scratch->Count(writable, n - writable);
     }
 
+    // a capped read says nothing about the sizes the peer sends
+    if (n > 0 && max_bytes >= space) AdaptReadHint(n, space);
+
     return n;
-}
\ No newline at end of file
+}
+
+void Buffer::AdaptReadHint(size_t n, size_t writable)
+{
+    static const int kShrinkAfter = 16;
+
+    if (n >= writable) {
+        // filled what was reserved, there is likely more where that came from
+        m_read_hint = std::min(kMaxReadHint, std::max(m_read_hint * 2, n));
+        m_small_reads = 0;
+    } else if (n < m_read_hint / 4) {
+        if (++m_small_reads >= kShrinkAfter) {
+            m_read_hint = std::max(kInitialSize, m_read_hint / 2);
+            m_small_reads = 0;
+        }
+    } else {
+        m_small_reads = 0;
+    }
+}
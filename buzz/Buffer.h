@@ -1,13 +1,60 @@
 #pragma once
 
+#include "noncopyable.h"
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 namespace buzz
 {
+    class ChunkPool;
+
+    //
+    // overflow area for Buffer::ReadFd, one per EventLoop and shared by the
+    // input buffers of its connections. counts the bytes read straight into
+    // buffers and the bytes that went through the scratch area and had to
+    // be copied; written by the loop thread, readable from any thread.
+    //
+    class ReadScratch : noncopyable
+    {
+    public:
+        static const size_t kSize = 64 * 1024;
+
+        ReadScratch() : m_data(new char[kSize]), m_in_place_bytes(0), m_copied_bytes(0)
+        { }
+
+        char* Data() { return m_data.get(); }
+
+        uint64_t InPlaceBytes() const { return m_in_place_bytes.load(std::memory_order_relaxed); }
+        uint64_t CopiedBytes() const { return m_copied_bytes.load(std::memory_order_relaxed); }
+
+        void Count(size_t in_place, size_t copied)
+        {
+            Add(&m_in_place_bytes, in_place);
+            Add(&m_copied_bytes, copied);
+        }
+
+    private:
+        std::unique_ptr<char[]> m_data;
+
+        std::atomic<uint64_t> m_in_place_bytes;
+        std::atomic<uint64_t> m_copied_bytes;
+
+        static void Add(std::atomic<uint64_t>* counter, size_t n)
+        {
+            counter->store(counter->load(std::memory_order_relaxed) + n,
+                           std::memory_order_relaxed);
+        }
+    };
+
     //
     // +-----------------------------------------------------+
     // | prependable bytes | readable bytes | writable bytes |
@@ -22,27 +69,50 @@ namespace buzz
         static const size_t kCheapPrepend = 8;
         static const size_t kInitialSize = 1024;
 
-        Buffer()
-            : m_buffer(kCheapPrepend + kInitialSize),
+        // upper bound of the space ReadFd reserves from observed read sizes,
+        // the storage then still fits the largest ChunkPool class
+        static const size_t kMaxReadHint = 256 * 1024 - kCheapPrepend;
+
+        // storage comes from pool when given, from the heap otherwise. it is
+        // allocated on the first write, not here
+        explicit Buffer(ChunkPool* pool = NULL)
+            : m_pool(pool),
+            m_data(EmptyStorage()),
+            m_capacity(kCheapPrepend),
             m_reader_index(kCheapPrepend),
-            m_writer_index(kCheapPrepend)
+            m_writer_index(kCheapPrepend),
+            m_read_hint(kInitialSize),
+            m_small_reads(0)
         {
             assert(ReadableBytes() == 0);
-            assert(WritableBytes() == kInitialSize);
             assert(PrependableBytes() == kCheapPrepend);
         }
 
+        Buffer(const Buffer& rhs);
+        Buffer(Buffer&& rhs);
+
+        Buffer& operator=(Buffer rhs) { swap(rhs); return *this; }
+
+        ~Buffer() { FreeStorage(); }
+
         void swap(Buffer& rhs)
         {
-            m_buffer.swap(rhs.m_buffer);
+            std::swap(m_pool, rhs.m_pool);
+            std::swap(m_data, rhs.m_data);
+            std::swap(m_capacity, rhs.m_capacity);
             std::swap(m_reader_index, rhs.m_reader_index);
             std::swap(m_writer_index, rhs.m_writer_index);
+            std::swap(m_read_hint, rhs.m_read_hint);
+            std::swap(m_small_reads, rhs.m_small_reads);
         }
 
         size_t ReadableBytes() const { return m_writer_index - m_reader_index; }
-        size_t WritableBytes() const { return m_buffer.size() - m_writer_index;}
+        size_t WritableBytes() const { return m_capacity - m_writer_index;}
         size_t PrependableBytes() const { return m_reader_index; }
 
+        // bytes of storage held, 0 once released
+        size_t Capacity() const { return HasStorage() ? m_capacity : 0; }
+
         const char* Peek() const { return Begin() + m_reader_index; }
 
         void Retrieve(size_t len)
@@ -89,18 +159,17 @@ namespace buzz
 
         void Prepend(const void* data, size_t len)
         {
+            if (HasStorage() == false) Reallocate(0);
+
             assert(len <= PrependableBytes());
             m_reader_index -= len;
             const char* t = static_cast<const char*>(data);
-            std::copy(t, t + len, Begin() + len);
+            std::copy(t, t + len, Begin() + m_reader_index);
         }
 
         void Shrink(size_t reserve)
         {
-            Buffer other;
-            other.EnsureWritableBytes(ReadableBytes() + reserve);
-            other.Append(Begin(), ReadableBytes());
-            swap(other);
+            Reallocate(reserve);
         }
 
         void EnsureWritableBytes(size_t len)
@@ -111,21 +180,58 @@ namespace buzz
             assert(WritableBytes() >= len);
         }
 
-        ssize_t ReadFd(int fd, int* err_code);
+        // hands the storage back to the pool or heap when nothing is readable,
+        // the next write allocates again. returns whether storage was freed
+        bool Release()
+        {
+            if (ReadableBytes() > 0 || HasStorage() == false) return false;
+
+            FreeStorage();
+            m_data = EmptyStorage();
+            m_capacity = kCheapPrepend;
+            RetrieveAll();
+
+            return true;
+        }
+
+        // reads into the writable space, overflowing into scratch which is
+        // then appended. the space reserved before reading follows the read
+        // sizes seen so far: it doubles when a read overflows and halves after
+        // a run of reads that used less than a quarter of it, so bulk
+        // connections end up reading in place. without a scratch the
+        // overflow goes to a thread local ReadScratch. reads at most max_bytes
+        ssize_t ReadFd(int fd, int* err_code, ReadScratch* scratch = NULL,
+                       size_t max_bytes = SIZE_MAX);
     private:
-        std::vector<char> m_buffer;
+        ChunkPool* m_pool;
+
+        char*  m_data;
+        size_t m_capacity;
 
         size_t m_reader_index;
         size_t m_writer_index;
 
-        char* Begin() { return m_buffer.data(); }
-        const char* Begin() const { return m_buffer.data(); }
+        size_t m_read_hint;
+        int    m_small_reads;
+
+        char* Begin() { return m_data; }
+        const char* Begin() const { return m_data; }
+
+        // shared placeholder of kCheapPrepend bytes for buffers without storage,
+        // keeps Peek and BeginWrite valid pointers. never written
+        static char* EmptyStorage()
+        {
+            static char s_empty[kCheapPrepend];
+            return s_empty;
+        }
+
+        bool HasStorage() const { return m_data != EmptyStorage(); }
 
         void MakeSpace(size_t len)
         {
-            if (WritableBytes() + PrependableBytes() < len + kCheapPrepend) {
-               
-                m_buffer.resize(m_writer_index + len);
+            if (HasStorage() == false ||
+                WritableBytes() + PrependableBytes() < len + kCheapPrepend) {
+                Reallocate(std::max(len, HasStorage() ? m_capacity : kInitialSize));
             } else {
                 assert(kCheapPrepend < m_reader_index);
 
@@ -139,5 +245,11 @@ namespace buzz
                 assert(readable == ReadableBytes());
             }
         }
+
+        // moves the readable bytes to new storage with at least writable free
+        void Reallocate(size_t writable);
+        void FreeStorage();
+
+        void AdaptReadHint(size_t n, size_t writable);
     };
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <memory>
 #include <functional>
 
+#include <stddef.h>
+
 namespace buzz
 {    
     typedef std::function<void()> EventHandler;
@@ -18,6 +20,11 @@ namespace buzz
     typedef std::function<void(const TcpConnectionPtr&)> StateChangeEventHandler;
     typedef std::function<void(const TcpConnectionPtr&)> WriteCompleteEventHandler;
     typedef std::function<void(const TcpConnectionPtr&, int)> ErrorEventHandler;
+    typedef std::function<void(const TcpConnectionPtr&, size_t)> HighWaterMarkEventHandler;
+    typedef std::function<void(const TcpConnectionPtr&)> LowWaterMarkEventHandler;
+
+    enum TimeoutType { kIdleTimeout, kReadTimeout, kWriteTimeout };
+    typedef std::function<void(const TcpConnectionPtr&, TimeoutType)> TimeoutEventHandler;
 
     class Buffer;
     typedef std::function<void(const TcpConnectionPtr&, 
@@ -0,0 +1,284 @@
+#include "ChunkPool.h"
+#include "ChainBuffer.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+using namespace buzz;
+
+ChainBuffer::ChainBuffer(ChunkPool* pool)
+    : m_pool(pool),
+    m_segments(PoolAllocator<Segment>(pool)),
+    m_readable(0),
+    m_zerocopy_threshold(0),
+    m_zerocopy_next_seq(0),
+    m_zerocopy_pending(PoolAllocator<ZeroCopyOwner>(pool)),
+    m_zerocopy_sends(0),
+    m_zerocopy_copied(0)
+{ }
+
+ChainBuffer::~ChainBuffer()
+{
+    while (m_segments.empty() == false) {
+        PopFront();
+    }
+}
+
+void ChainBuffer::Append(const void* data, size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    m_readable += len;
+
+    while (len > 0) {
+        if (m_segments.empty() || m_segments.back().IsChunk() == false ||
+            m_segments.back().m_write == ChunkPool::kChunkSize) {
+            Segment segment = { m_pool->Allocate(), 0, 0, -1, NULL, false, 0 };
+            m_segments.push_back(segment);
+        }
+
+        Segment& back = m_segments.back();
+
+        size_t n = std::min(len, ChunkPool::kChunkSize - back.m_write);
+        ::memcpy(back.m_data + back.m_write, p, n);
+
+        back.m_write += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::AppendFile(int fd, off_t offset, size_t length)
+{
+    if (length == 0) {
+        ::close(fd);
+        return;
+    }
+
+    Segment segment = { NULL, static_cast<size_t>(offset), offset + length, fd, NULL, false, 0 };
+    m_segments.push_back(segment);
+
+    m_readable += length;
+}
+
+void ChainBuffer::AppendExternal(const char* data, size_t len, const std::shared_ptr<void>& owner)
+{
+    if (len == 0) return;
+
+    assert(owner);
+
+    Segment segment = { const_cast<char*>(data), 0, len, -1, owner, false, 0 };
+    m_segments.push_back(segment);
+
+    m_readable += len;
+}
+
+void ChainBuffer::Retrieve(size_t len)
+{
+    assert(len <= m_readable);
+    m_readable -= len;
+
+    while (len > 0) {
+        Segment& front = m_segments.front();
+
+        size_t n = std::min(len, front.m_write - front.m_read);
+        front.m_read += n;
+        len -= n;
+
+        if (front.m_read == front.m_write) PopFront();
+    }
+}
+
+void ChainBuffer::RetrieveAll()
+{
+    Retrieve(m_readable);
+}
+
+int ChainBuffer::PeekIov(struct iovec* iov, int max) const
+{
+    int n = 0;
+
+    for (auto it = m_segments.begin(); it != m_segments.end() && n < max; ++it) {
+        if (it->IsFile()) break;
+        if (it->m_read == it->m_write) continue;
+
+        iov[n].iov_base = it->m_data + it->m_read;
+        iov[n].iov_len  = it->m_write - it->m_read;
+        n++;
+    }
+
+    return n;
+}
+
+ssize_t ChainBuffer::WriteFd(int fd, int* err_code, size_t max_bytes)
+{
+    if (m_segments.empty() || max_bytes == 0) return 0;
+
+    const Segment& front = m_segments.front();
+
+    if (front.IsFile()) {
+        return SendFile(fd, err_code, max_bytes);
+    }
+
+    if (m_zerocopy_threshold > 0 && front.m_owner &&
+        std::min(front.m_write - front.m_read, max_bytes) >= m_zerocopy_threshold) {
+        ssize_t n = SendZeroCopy(fd, err_code, max_bytes);
+
+        // out of optmem for notifications, send this one by copying
+        if (n != -1 || *err_code != ENOBUFS) return n;
+    }
+
+    struct iovec iov[kMaxIov];
+
+    int iov_cnt = PeekIov(iov, kMaxIov);
+    if (iov_cnt == 0) return 0;
+
+    size_t total = 0;
+    for (int i = 0; i < iov_cnt; i++) {
+        if (total + iov[i].iov_len >= max_bytes) {
+            iov[i].iov_len = max_bytes - total;
+            iov_cnt = i + 1;
+            break;
+        }
+
+        total += iov[i].iov_len;
+    }
+
+    ssize_t n = ::writev(fd, iov, iov_cnt);
+
+    if (n == -1) {
+        *err_code = errno;
+    } else {
+        Retrieve(n);
+    }
+
+    return n;
+}
+
+ssize_t ChainBuffer::SendFile(int fd, int* err_code, size_t max_bytes)
+{
+    Segment& front = m_segments.front();
+
+    off_t offset = static_cast<off_t>(front.m_read);
+    ssize_t n = ::sendfile(fd, front.m_fd, &offset,
+                           std::min(front.m_write - front.m_read, max_bytes));
+
+    if (n == -1) {
+        *err_code = errno;
+    } else if (n == 0) {
+        // the file is shorter than the range queued, nothing more will come
+        *err_code = EIO;
+        m_readable -= front.m_write - front.m_read;
+        PopFront();
+        n = -1;
+    } else {
+        Retrieve(n);
+    }
+
+    return n;
+}
+
+ssize_t ChainBuffer::SendZeroCopy(int fd, int* err_code, size_t max_bytes)
+{
+    Segment& front = m_segments.front();
+
+    struct iovec iov;
+    iov.iov_base = front.m_data + front.m_read;
+    iov.iov_len  = std::min(front.m_write - front.m_read, max_bytes);
+
+    struct msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    ssize_t n = ::sendmsg(fd, &msg, MSG_ZEROCOPY);
+
+    if (n == -1) {
+        *err_code = errno;
+        return n;
+    }
+
+    // every successful zerocopy sendmsg takes the next notification number
+    front.m_zerocopy = true;
+    front.m_zerocopy_seq = m_zerocopy_next_seq++;
+    m_zerocopy_sends++;
+
+    Retrieve(n);
+
+    return n;
+}
+
+bool ChainBuffer::ReapZeroCopy(int fd)
+{
+    bool reaped = false;
+
+    for ( ; ; ) {
+        char control[128];
+
+        struct msghdr msg;
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) break;
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            const struct sock_extended_err* err =
+                reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) continue;
+
+            // notifications [ee_info, ee_data] are done, tcp completes them in order
+            uint32_t hi = err->ee_data;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                m_zerocopy_copied += hi - err->ee_info + 1;
+            }
+
+            while (m_zerocopy_pending.empty() == false &&
+                   static_cast<int32_t>(m_zerocopy_pending.front().m_seq - hi) <= 0) {
+                m_zerocopy_pending.pop_front();
+            }
+
+            reaped = true;
+        }
+    }
+
+    return reaped;
+}
+
+void ChainBuffer::MoveZeroCopyPending(ChainBuffer* other)
+{
+    for (auto& pending : m_zerocopy_pending) {
+        other->m_zerocopy_pending.push_back(std::move(pending));
+    }
+
+    m_zerocopy_pending.clear();
+}
+
+void ChainBuffer::PopFront()
+{
+    Segment& front = m_segments.front();
+
+    if (front.IsFile()) {
+        ::close(front.m_fd);
+    } else if (front.IsChunk()) {
+        m_pool->Free(front.m_data);
+    } else if (front.m_zerocopy) {
+        ZeroCopyOwner pending = { front.m_zerocopy_seq, std::move(front.m_owner) };
+        m_zerocopy_pending.push_back(std::move(pending));
+    }
+
+    m_segments.pop_front();
+}
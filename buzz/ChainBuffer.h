@@ -0,0 +1,137 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "PoolAllocator.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct iovec;
+
+namespace buzz
+{
+    //
+    // output queue made of fixed-size chunks from a ChunkPool
+    //
+    // +---------------+    +---------------+    +---------------+
+    // | free | data   | -> |     data      | -> | data |  free  |
+    // +---------------+    +---------------+    +---------------+
+    //   front segment                              back segment
+    //
+    // appending fills the back chunk and then takes new ones, queued bytes
+    // are never moved or copied again. a file range is queued as its own
+    // segment and sent with sendfile when it reaches the front, memory
+    // owned by the caller is queued by reference. WriteFd sends several
+    // memory segments with one writev and returns drained chunks to the
+    // pool. large external segments can go out with MSG_ZEROCOPY, their
+    // owners are then held until the kernel reports it is done with them.
+    //
+    class ChainBuffer : noncopyable
+    {
+    public:
+        // segments handed to a single writev
+        static const int kMaxIov = 64;
+
+        explicit ChainBuffer(ChunkPool* pool);
+        ~ChainBuffer();
+
+        size_t ReadableBytes() const { return m_readable; }
+        size_t SegmentCount() const { return m_segments.size(); }
+
+        void Append(const void* data, size_t len);
+        void Append(const std::string& str) { Append(str.data(), str.size()); }
+
+        // queues length bytes of fd from offset, the buffer takes ownership of
+        // fd and closes it once the range is sent or the buffer is destroyed
+        void AppendFile(int fd, off_t offset, size_t length);
+
+        // queues len bytes at data without copying them, data must stay valid
+        // while owner is alive. the owner is released once the bytes are sent,
+        // or acknowledged when they went out with zerocopy
+        void AppendExternal(const char* data, size_t len, const std::shared_ptr<void>& owner);
+
+        // external segments of at least threshold bytes are sent with
+        // MSG_ZEROCOPY, the socket must have SO_ZEROCOPY enabled. 0 turns it off
+        void SetZeroCopyThreshold(size_t threshold) { m_zerocopy_threshold = threshold; }
+        size_t ZeroCopyThreshold() const { return m_zerocopy_threshold; }
+
+        // reads zerocopy completions from the error queue of fd and releases
+        // the owners they cover, returns false when there were none
+        bool ReapZeroCopy(int fd);
+
+        // owners waiting for a zerocopy completion
+        size_t ZeroCopyPending() const { return m_zerocopy_pending.size(); }
+
+        // hands the owners waiting for a completion over to other, which
+        // then reaps them from the same socket
+        void MoveZeroCopyPending(ChainBuffer* other);
+
+        // zerocopy sends, and those the kernel completed by copying anyway
+        // (loopback, or a device without scatter-gather)
+        uint64_t ZeroCopySends() const { return m_zerocopy_sends; }
+        uint64_t ZeroCopyCopied() const { return m_zerocopy_copied; }
+
+        void Retrieve(size_t len);
+        void RetrieveAll();
+
+        // fills at most max iovecs with the front memory segments, stops at
+        // the first file segment. returns how many
+        int PeekIov(struct iovec* iov, int max) const;
+
+        // writev of the front memory segments, sendmsg with MSG_ZEROCOPY of a
+        // large front external segment or sendfile of a front file segment.
+        // at most max_bytes. retrieves what was written
+        ssize_t WriteFd(int fd, int* err_code, size_t max_bytes = SIZE_MAX);
+
+    private:
+        // memory segments hold m_data[m_read, m_write) of a pool chunk, or of
+        // caller memory kept alive by m_owner; file segments the byte range
+        // [m_read, m_write) of m_fd
+        struct Segment
+        {
+            char*  m_data;
+            size_t m_read;
+            size_t m_write;
+            int    m_fd;
+
+            std::shared_ptr<void> m_owner;
+
+            // sequence number of the last zerocopy send from this segment
+            bool     m_zerocopy;
+            uint32_t m_zerocopy_seq;
+
+            bool IsFile() const { return m_data == NULL; }
+            bool IsChunk() const { return m_data && m_owner == NULL; }
+        };
+
+        struct ZeroCopyOwner
+        {
+            uint32_t              m_seq;
+            std::shared_ptr<void> m_owner;
+        };
+
+        ChunkPool* m_pool;
+
+        // the queues take their blocks from the pool too, a deque allocates
+        // as soon as it is constructed
+        std::deque<Segment, PoolAllocator<Segment>> m_segments;
+        size_t                                      m_readable;
+
+        size_t                                                  m_zerocopy_threshold;
+        uint32_t                                                m_zerocopy_next_seq;
+        std::deque<ZeroCopyOwner, PoolAllocator<ZeroCopyOwner>> m_zerocopy_pending;
+
+        uint64_t m_zerocopy_sends;
+        uint64_t m_zerocopy_copied;
+
+        ssize_t SendFile(int fd, int* err_code, size_t max_bytes);
+        ssize_t SendZeroCopy(int fd, int* err_code, size_t max_bytes);
+
+        void PopFront();
+    };
+}
@@ -15,16 +15,64 @@ Channel::Channel(EventLoop* loop, int fd, int events)
     m_poller(loop->GetPoller()),
     m_fd(fd),
     m_id(g_channel_id++),
-    m_events(events)
+    m_events(events),
+    m_revents(kNoneEvent),
+    m_registered_events(kNoneEvent),
+    m_added(false),
+    m_update_pending(false),
+    m_tied(false),
+    m_completion(kCompletionNone),
+    m_completion_buffer(NULL),
+    m_completing(false),
+    m_completions(PoolAllocator<int>(loop->GetChunkPool()))
 {
     assert(m_owner_loop);
 
-    m_poller->AddChannel(this);
+    Update();
 }
 
 Channel::~Channel()
 {
+    if (m_added) m_poller->RemoveChannel(this);
+}
+
+void Channel::Remove()
+{
+    if (m_added == false) return;
+
     m_poller->RemoveChannel(this);
+
+    m_added = false;
+    m_update_pending = false;
+    m_registered_events = kNoneEvent;
+}
+
+void Channel::Update()
+{
+    if (m_update_pending || m_events == m_registered_events) return;
+
+    m_update_pending = true;
+
+    // registration is deferred until there is some interest, so a channel
+    // created with kNoneEvent costs nothing until it is enabled in its loop
+    if (m_added == false) {
+        m_added = true;
+        m_poller->AddChannel(this);
+    } else {
+        m_poller->UpdateChannel(this);
+    }
+}
+
+void Channel::SetCompletion(CompletionOp op, Buffer* buffer)
+{
+    m_completion = op;
+    if (buffer) m_completion_buffer = buffer;
+
+    // the interest mask is unchanged, the poller is told all the same
+    if (m_added && m_update_pending == false) {
+        m_update_pending = true;
+        m_poller->UpdateChannel(this);
+    }
 }
 
 void Channel::EnableRead(bool enable)
@@ -35,7 +83,7 @@ void Channel::EnableRead(bool enable)
         m_events &= (~kReadEvent);
     }
     
-    m_poller->UpdateChannel(this);
+    Update();
 }
 
 void Channel::EnableWrite(bool enable)
@@ -46,7 +94,7 @@ void Channel::EnableWrite(bool enable)
         m_events &= (~kWriteEvent);
     }
 
-    m_poller->UpdateChannel(this);
+    Update();
 }
 
 void Channel::EnableReadWrite(bool readable, bool writable)
@@ -63,18 +111,55 @@ void Channel::EnableReadWrite(bool readable, bool writable)
         m_events &= (~kWriteEvent);
     }
 
-    m_poller->UpdateChannel(this);
+    Update();
+}
+
+void Channel::EnableEdgeTriggered(bool enable)
+{
+    if (enable) {
+        m_events |= kEdgeTriggered;
+    } else {
+        m_events &= (~kEdgeTriggered);
+    }
+
+    Update();
 }
 
 void Channel::HandleEvent(Timestamp timestamp)
 {
+    std::shared_ptr<void> guard;
+    if (m_tied) {
+        guard = m_tie.lock();
+        if (guard == NULL) return;
+    }
+
+    bool handled = false;
+
+    if ((m_revents & kErrorEvent) && m_error_event_handler) {
+        LOG(TRACE) << "channel " << m_id << " fd " << m_fd << " handle error";
+        m_error_event_handler();
+        handled = true;
+    }
+
+    // both sides in one event, an edge-triggered write edge would be lost otherwise
     if (m_revents & kReadEvent) {
         LOG(TRACE) << "channel " << m_id << " fd " << m_fd << " handle read";
         if (m_read_event_handler)  m_read_event_handler(timestamp);
-    } else if (m_revents & kWriteEvent) {
+        handled = true;
+    }
+
+    if (m_revents & kWriteEvent) {
         LOG(TRACE) << "channel " << m_id << " fd " << m_fd << " handle wrte";
         if (m_write_event_handler) m_write_event_handler();
-    } else {
-        LOG(FATAL) << "Channel::HandleEvent unexpected poller events";
+        handled = true;
+    }
+
+    if (handled == false) {
+        // error or hangup nobody asked for, let the read side run into it
+        if (m_read_event_handler) {
+            m_read_event_handler(timestamp);
+        } else {
+            LOG(FATAL) << "Channel::HandleEvent unexpected poller events";
+        }
     }
 }
\ No newline at end of file
@@ -2,19 +2,38 @@
 
 #include "Callbacks.h"
 #include "noncopyable.h"
+#include "PoolAllocator.h"
+
+#include <memory>
+#include <vector>
 
 namespace buzz
 {
     const int kNoneEvent = 0;
     extern const int kReadEvent;
     extern const int kWriteEvent;
+    extern const int kEdgeTriggered;
+
+    // reported without being asked for, on a socket error or a non-empty error queue
+    extern const int kErrorEvent;
+
+    // wake only one of the pollers waiting on a shared fd, given at construction
+    // as it cannot be changed on a registered channel
+    extern const int kExclusive;
 
     class Poller;
     class EventLoop;
 
+    // how a poller may serve the read side of a channel instead of reporting
+    // readiness, see Channel::SetCompletion
+    enum CompletionOp { kCompletionNone, kCompletionAccept, kCompletionRecv };
+
     class Channel : noncopyable
     {
     public:
+        // from the loop's pool, a channel comes and goes with its connection
+        typedef std::vector<int, PoolAllocator<int>> CompletionList;
+
         Channel(EventLoop* loop, int fd, int events);
         ~Channel();
 
@@ -24,17 +43,54 @@ namespace buzz
         void EnableRead(bool enable);
         void EnableWrite(bool enable);
         void EnableReadWrite(bool readable, bool writable);
+        void EnableEdgeTriggered(bool enable);
 
         bool ReadEnable()  { return m_events & kReadEvent; }
         bool WriteEnable() { return m_events & kWriteEvent; }
+        bool EdgeTriggered() { return m_events & kEdgeTriggered; }
 
         void OnWrite(const EventHandler&& handler) { m_write_event_handler = handler; }
         void OnRead(const ReadEventHandler&& handler) { m_read_event_handler = handler; }
+        void OnError(const EventHandler&& handler) { m_error_event_handler = handler; }
+
+        // keeps owner alive while handling an event, and drops events once it
+        // is gone, for handlers bound to an object that one of them may release
+        void Tie(const std::shared_ptr<void>& owner) { m_tie = owner; m_tied = true; }
+
+        // leaves the poller now, in the loop thread, so that destroying the
+        // channel later from another thread does not touch it. enabling an
+        // event adds it again
+        void Remove();
 
         void HandleEvent(Timestamp timestamp);
 
         int  GetEvents() { return m_events; }
+        int  GetRevents() { return m_revents; }
         void SetRevents(int revents) { m_revents = revents; }
+
+        // interest mask last applied to the kernel by the poller, changes to
+        // m_events are queued once and applied by the poller before its next Poll
+        int  GetRegisteredEvents() { return m_registered_events; }
+        void SetRegisteredEvents(int events) { m_registered_events = events; }
+
+        bool UpdatePending() { return m_update_pending; }
+        void SetUpdatePending(bool pending) { m_update_pending = pending; }
+
+        // a poller that supports it (io_uring) accepts on the fd, or receives
+        // on it and appends to buffer, by itself. it queues each result, an
+        // accepted fd or a byte count, 0 at EOF and -errno on failure, then
+        // reports kReadEvent. Completing tells whether it serves the read side
+        // this way at the moment, readiness is reported as usual otherwise.
+        // the buffer stays once given, an op switched off may still complete
+        void SetCompletion(CompletionOp op, Buffer* buffer = NULL);
+
+        CompletionOp GetCompletion() { return m_completion; }
+        Buffer* GetCompletionBuffer() { return m_completion_buffer; }
+
+        bool Completing() { return m_completing; }
+        void SetCompleting(bool completing) { m_completing = completing; }
+
+        CompletionList& Completions() { return m_completions; }
         
         EventLoop* GetOwnerLoop() { return m_owner_loop; }
     private:
@@ -46,8 +102,23 @@ namespace buzz
 
         int m_events;
         int m_revents;
+        int m_registered_events;
+
+        bool m_added;
+        bool m_update_pending;
+        bool m_tied;
+
+        CompletionOp     m_completion;
+        Buffer*          m_completion_buffer;
+        bool             m_completing;
+        CompletionList   m_completions;
+
+        std::weak_ptr<void> m_tie;
 
         EventHandler     m_write_event_handler;
+        EventHandler     m_error_event_handler;
         ReadEventHandler m_read_event_handler;
+
+        void Update();
     };
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "ChunkPool.h"
+
+#include <string.h>
+
+using namespace buzz;
+
+std::atomic<size_t> ChunkPool::s_total_bytes_in_use(0);
+
+ChunkPool::ChunkPool(size_t max_cached_bytes)
+    : m_max_cached_bytes(max_cached_bytes),
+    m_bytes_in_use(0),
+    m_bytes_cached(0)
+{
+    ::memset(m_free, 0, sizeof(m_free));
+}
+
+ChunkPool::~ChunkPool()
+{
+    for (int i = 0; i < kClasses; i++) {
+        while (m_free[i]) {
+            FreeBlock* next = m_free[i]->m_next;
+            delete[] reinterpret_cast<char*>(m_free[i]);
+            m_free[i] = next;
+        }
+    }
+}
+
+// smallest class holding size, -1 above kMaxClassSize
+int ChunkPool::SizeClass(size_t size)
+{
+    int index = 0;
+    size_t class_size = kMinClassSize;
+
+    while (class_size < size) {
+        if (++index == kClasses) return -1;
+        class_size <<= 1;
+    }
+
+    return index;
+}
+
+char* ChunkPool::Allocate(size_t size, size_t* capacity)
+{
+    int index = SizeClass(size);
+    *capacity = Capacity(size);
+
+    m_bytes_in_use.fetch_add(*capacity, std::memory_order_relaxed);
+    s_total_bytes_in_use.fetch_add(*capacity, std::memory_order_relaxed);
+
+    if (index >= 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_free[index]) {
+            FreeBlock* block = m_free[index];
+            m_free[index] = block->m_next;
+            m_bytes_cached.fetch_sub(*capacity, std::memory_order_relaxed);
+
+            return reinterpret_cast<char*>(block);
+        }
+    }
+
+    return new char[*capacity];
+}
+
+void ChunkPool::Free(char* block, size_t capacity)
+{
+    m_bytes_in_use.fetch_sub(capacity, std::memory_order_relaxed);
+    s_total_bytes_in_use.fetch_sub(capacity, std::memory_order_relaxed);
+
+    int index = SizeClass(capacity);
+
+    if (index >= 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_bytes_cached.load(std::memory_order_relaxed) + capacity <= m_max_cached_bytes) {
+            FreeBlock* free_block = reinterpret_cast<FreeBlock*>(block);
+            free_block->m_next = m_free[index];
+            m_free[index] = free_block;
+            m_bytes_cached.fetch_add(capacity, std::memory_order_relaxed);
+
+            return;
+        }
+    }
+
+    delete[] block;
+}
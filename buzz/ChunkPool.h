@@ -0,0 +1,75 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <mutex>
+#include <atomic>
+
+#include <stddef.h>
+
+namespace buzz
+{
+    //
+    // size-class pool of buffer storage, one per EventLoop. backs both the
+    // fixed chunks of ChainBuffer and the contiguous storage of Buffer, and
+    // through PoolAllocator the connections of the loop and their segment
+    // queues. classes are powers of two from 64 bytes to 256 KiB, larger
+    // blocks come straight from the heap. buffers may be destroyed outside
+    // the loop thread together with their connection, so the free lists are
+    // locked; they are uncontended in the common case. free blocks are cached
+    // up to max_cached_bytes per pool, the rest go back to the heap.
+    //
+    class ChunkPool : noncopyable
+    {
+    public:
+        static const size_t kChunkSize = 16 * 1024;
+
+        static const size_t kMinClassSize = 64;
+        static const size_t kMaxClassSize = 256 * 1024;
+        static const int    kClasses = 13;
+
+        static const size_t kDefaultMaxCachedBytes = 4 * 1024 * 1024;
+
+        explicit ChunkPool(size_t max_cached_bytes = kDefaultMaxCachedBytes);
+        ~ChunkPool();
+
+        // a kChunkSize block
+        char* Allocate() { size_t capacity; return Allocate(kChunkSize, &capacity); }
+        void Free(char* chunk) { Free(chunk, kChunkSize); }
+
+        // a block of at least size bytes, its real size is stored in capacity
+        // and must be passed back to Free
+        char* Allocate(size_t size, size_t* capacity);
+        void Free(char* block, size_t capacity);
+
+        // the capacity Allocate gives a block of size bytes
+        static size_t Capacity(size_t size)
+        {
+            int index = SizeClass(size);
+            return index < 0 ? size : kMinClassSize << index;
+        }
+
+        // bytes held by buffers and connections, and free bytes cached in this pool
+        size_t BytesInUse() const { return m_bytes_in_use.load(std::memory_order_relaxed); }
+        size_t BytesCached() const { return m_bytes_cached.load(std::memory_order_relaxed); }
+
+        // bytes held by buffers across all pools of the process, for capping
+        // buffer memory per process
+        static size_t TotalBytesInUse() { return s_total_bytes_in_use.load(std::memory_order_relaxed); }
+
+    private:
+        struct FreeBlock { FreeBlock* m_next; };
+
+        const size_t m_max_cached_bytes;
+
+        std::mutex m_mutex;
+        FreeBlock* m_free[kClasses];
+
+        std::atomic<size_t> m_bytes_in_use;
+        std::atomic<size_t> m_bytes_cached;
+
+        static std::atomic<size_t> s_total_bytes_in_use;
+
+        static int SizeClass(size_t size);
+    };
+}
@@ -1,7 +1,9 @@
 #include "Poller.h"
 #include "Logger.h"
 #include "Channel.h"
+#include "ChunkPool.h"
 #include "EventLoop.h"
+#include "TimeoutWheel.h"
 
 #include <fcntl.h>
 #include <errno.h>
@@ -9,9 +11,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 
 using namespace buzz;
 
+const int64_t EventLoop::kBusyWindow;
+
 struct IgnSigPipe
 {
     IgnSigPipe()
@@ -24,15 +29,33 @@ IgnSigPipe g_ign_sig_pipe;
 
 __thread EventLoop* t_loop_in_this_thread = NULL;
 
-EventLoop::EventLoop()
+struct EventLoop::PendingTask : public MpscNode
+{
+    PendingTask(TaskCallback&& task) : m_task(std::move(task))
+    { }
+
+    TaskCallback m_task;
+};
+
+EventLoop::EventLoop(const EventLoopOptions& options)
     : m_thread_id(CurrentThread::threadId()),
     m_exited(false), 
     m_looping(false),
-    m_poller(MakePoller()),
-    m_timer_manager(this),
+    m_chunk_pool(new ChunkPool()),
+    m_poller(MakePoller(options.poller_type)),
+    m_timer_manager(this, options.timer_queue_type, options.use_timerfd),
     m_wakeup_channel(NULL),
-    m_tasks(0)
+    m_wall_offset(0),
+    m_wakeup_fd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_wakeup_pending(false),
+    m_wakeups_saved(0),
+    m_connections(0),
+    m_busy_window(0),
+    m_busy_current(0),
+    m_busy_previous(0)
 {
+    UpdateTime();
+
     LOG(DEBUG) << "EventLoop created " << this << " in thread " << m_thread_id;
 
     if (t_loop_in_this_thread) {
@@ -42,28 +65,13 @@ EventLoop::EventLoop()
 
     t_loop_in_this_thread = this;
 
-    if (pipe2(m_wakeup_pipe, O_CLOEXEC) == -1) {
-        LOG(FATAL) << "pipe2 create m_wakeup_pipe error " 
+    if (m_wakeup_fd == -1) {
+        LOG(FATAL) << "eventfd create m_wakeup_fd error "
                    << errno << " ("<< ::strerror(errno) << ')';
     }
 
-    m_wakeup_channel = new Channel(this, m_wakeup_pipe[0], kReadEvent);
-    m_wakeup_channel->OnRead([=](Timestamp time) {
-        char buf[1024];
-        ssize_t ret = ::read(m_wakeup_channel->GetFd(), buf, sizeof(buf));
-        if (ret > 0) {
-            TaskCallback task;
-
-            while (m_tasks.Poll(task, 0)) { 
-                task();
-            }
-        } else if (ret == 0){
-            delete m_wakeup_channel;
-            m_wakeup_channel = NULL;
-        } else {
-            LOG(FATAL) << "wakeup channel read error " << errno << " (" << strerror(errno) << ')';
-        }
-    });
+    m_wakeup_channel = new Channel(this, m_wakeup_fd, kReadEvent);
+    m_wakeup_channel->OnRead(std::bind(&EventLoop::HandleWakeup, this));
 }
 
 EventLoop::~EventLoop()
@@ -73,8 +81,12 @@ EventLoop::~EventLoop()
     
     if (m_wakeup_channel) delete m_wakeup_channel;
 
-    ::close(m_wakeup_pipe[0]);
-    ::close(m_wakeup_pipe[1]);
+    ::close(m_wakeup_fd);
+
+    PendingTask* pending;
+    while ((pending = m_tasks.Pop()) != NULL) {
+        delete pending;
+    }
 
     t_loop_in_this_thread = NULL;
 }
@@ -91,26 +103,88 @@ void EventLoop::Loop()
         m_active_channel.clear();
 
         int timeout = m_timer_manager.NearEndTime();
+        if (timeout < 0 && m_timer_manager.UseTimerfd() == false) {
+            timeout = 5 * 1000;
+        }
         
-        m_poll_return_time = m_poller->Poll(timeout < 0 ? (5 * 1000) : timeout,
-                                            &m_active_channel);
-        
+        m_poller->Poll(timeout, &m_active_channel);
+        UpdateTime();
+
         int nready = m_active_channel.size();
         for (int i = 0; i < nready; i++) {
             m_active_channel[i]->HandleEvent(m_poll_return_time);
         }
 
-        m_timer_manager.Schedule();
+        if (m_timer_manager.UseTimerfd() == false) {
+            m_timer_manager.Schedule();
+        }
+
+        DoIterationEndTasks();
+        RecordBusyTime();
     }
 
     LOG(TRACE) << "EventLoop " << this << " stop looping";
     m_looping = false;
 }
 
+// the time from Poll returning to the end of the iteration, summed per
+// window. one clock read per iteration
+void EventLoop::RecordBusyTime()
+{
+    int64_t start = m_now.MicroSecondsSinceEpoch();
+    int64_t busy = Timestamp::Monotonic().MicroSecondsSinceEpoch() - start;
+
+    int64_t window = start / kBusyWindow;
+    int64_t last = m_busy_window.load(std::memory_order_relaxed);
+
+    if (window != last) {
+        int64_t previous = window == last + 1 ? m_busy_current.load(std::memory_order_relaxed) : 0;
+
+        m_busy_previous.store(previous, std::memory_order_relaxed);
+        m_busy_current.store(0, std::memory_order_relaxed);
+        m_busy_window.store(window, std::memory_order_relaxed);
+    }
+
+    m_busy_current.store(m_busy_current.load(std::memory_order_relaxed) + busy,
+                         std::memory_order_relaxed);
+}
+
+int64_t EventLoop::RecentBusyTime(int64_t now) const
+{
+    int64_t window = now / kBusyWindow;
+    int64_t last = m_busy_window.load(std::memory_order_relaxed);
+
+    if (last == window) {
+        return m_busy_previous.load(std::memory_order_relaxed) +
+               m_busy_current.load(std::memory_order_relaxed);
+    }
+
+    // the current window has not started in the loop yet
+    if (last == window - 1) return m_busy_current.load(std::memory_order_relaxed);
+
+    return 0;
+}
+
+void EventLoop::UpdateTime()
+{
+    m_now = Timestamp::Monotonic();
+
+    // a wall clock step shows up in PollReturnTime within a second, it never
+    // moves timers since those run on the monotonic clock
+    if (m_wall_sampled.Valid() == false ||
+        m_now.MicroSecondsSinceEpoch() - m_wall_sampled.MicroSecondsSinceEpoch() >=
+        Timestamp::kMicroSecondsPerSecond) {
+        m_wall_offset = Timestamp::Now().MicroSecondsSinceEpoch() - m_now.MicroSecondsSinceEpoch();
+        m_wall_sampled = m_now;
+    }
+
+    m_poll_return_time = Timestamp(m_now.MicroSecondsSinceEpoch() + m_wall_offset);
+}
+
 void EventLoop::Exit()
 {
     m_exited = true;
-    if (IsInLoopThread()) Wakeup();
+    if (IsInLoopThread() == false) Wakeup();
 }
 
 void EventLoop::AssertInLoopThread()
@@ -122,35 +196,85 @@ void EventLoop::AssertInLoopThread()
 
 TimerId EventLoop::RunAt(const Timestamp& time, TaskCallback&& task)
 {
-    return m_timer_manager.AddTimer(std::move(task), time, 0.0);
+    // wall clock to monotonic, the timer keeps its delay across later clock steps
+    double delay = TimeDifference(time, Timestamp::Now());
+    return RunAfter(delay, std::move(task));
 }
 
 TimerId EventLoop::RunAfter(double delay, TaskCallback&& task)
 {
-    Timestamp time(AddTime(Timestamp::Now(), delay));
-    return RunAt(time, std::move(task));
+    Timestamp time(AddTime(Timestamp::Monotonic(), delay));
+    return m_timer_manager.AddTimer(std::move(task), time, 0.0);
 }
 
 TimerId EventLoop::RunEvery(double interval, TaskCallback&& task)
 {
-    Timestamp time(AddTime(Timestamp::Now(), interval));
+    Timestamp time(AddTime(Timestamp::Monotonic(), interval));
     return m_timer_manager.AddTimer(std::move(task), time, interval);
 }
 
-void EventLoop::RunInLoop(const TaskCallback&& task)
+void EventLoop::Cancel(TimerId timer_id)
+{
+    m_timer_manager.Cannel(timer_id);
+}
+
+TimeoutWheel* EventLoop::Timeouts()
+{
+    AssertInLoopThread();
+
+    if (m_timeouts == NULL) {
+        m_timeouts.reset(new TimeoutWheel(this));
+    }
+
+    return m_timeouts.get();
+}
+
+void EventLoop::RunInLoop(TaskCallback&& task)
 {
     if (IsInLoopThread()) {
         task();
     } else {
-        m_tasks.Put(task);
+        QueueInLoop(std::move(task));
+    }
+}
+
+void EventLoop::QueueInLoop(TaskCallback&& task)
+{
+    m_tasks.Push(new PendingTask(std::move(task)));
+
+    // only the first post after a drain has to signal the loop
+    if (m_wakeup_pending.exchange(true, std::memory_order_acq_rel) == false) {
         Wakeup();
+    } else {
+        m_wakeups_saved.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void EventLoop::RunAtIterationEnd(TaskCallback&& task)
+{
+    AssertInLoopThread();
+    m_iteration_end_tasks.push_back(std::move(task));
+}
+
+void EventLoop::DoIterationEndTasks()
+{
+    // tasks added by these tasks run in the same pass, nothing waits for
+    // the next Poll timeout
+    while (m_iteration_end_tasks.empty() == false) {
+        m_iteration_end_batch.swap(m_iteration_end_tasks);
+
+        for (size_t i = 0; i < m_iteration_end_batch.size(); i++) {
+            m_iteration_end_batch[i]();
+        }
+
+        m_iteration_end_batch.clear();
     }
 }
 
 void EventLoop::Wakeup()
 {
-    char one = 1;
-    ssize_t n = ::write(m_wakeup_pipe[1], &one, sizeof(one));
+    uint64_t one = 1;
+    ssize_t n = ::write(m_wakeup_fd, &one, sizeof(one));
 
     if (n != sizeof(one)) {
         LOG(ERROR) << "EventLoop::Wakeup writes " << n << " bytes instead of " 
@@ -158,6 +282,38 @@ void EventLoop::Wakeup()
     }
 }
 
+void EventLoop::HandleWakeup()
+{
+    uint64_t count = 0;
+    ssize_t n = ::read(m_wakeup_fd, &count, sizeof(count));
+
+    if (n != sizeof(count) && errno != EAGAIN) {
+        LOG(FATAL) << "wakeup channel read error " << errno << " (" << strerror(errno) << ')';
+    }
+
+    m_wakeup_pending.exchange(false, std::memory_order_acq_rel);
+
+    DoPendingTasks();
+}
+
+void EventLoop::DoPendingTasks()
+{
+    PendingTask* pending;
+
+    // swap out everything posted so far, tasks posted while running the
+    // batch raise a new wakeup and are handled on the next iteration
+    while ((pending = m_tasks.Pop()) != NULL) {
+        m_pending_batch.push_back(pending);
+    }
+
+    for (size_t i = 0; i < m_pending_batch.size(); i++) {
+        m_pending_batch[i]->m_task();
+        delete m_pending_batch[i];
+    }
+
+    m_pending_batch.clear();
+}
+
 void EventLoop::AbortNotInLoopThread()
 {
     LOG(FATAL) << "EventLoop::AbortNotInLoopThread - EventLoop " << this
@@ -1,25 +1,47 @@
 #pragma once
 
 #include "Timer.h"
+#include "Buffer.h"
+#include "Poller.h"
 #include "Callbacks.h"
+#include "MpscQueue.h"
 #include "Timestamp.h"
 #include "noncopyable.h"
 #include "CurrentThread.h"
-#include "BlockingQueue.h"
 
 #include <atomic>
 
 namespace buzz
 {
-    class Poller;
     class Channel;
     class TimerId;
     class TimerManger;
+    class ChunkPool;
+    class TimeoutWheel;
+
+    struct EventLoopOptions
+    {
+        EventLoopOptions()
+            : poller_type(kPollerDefault),
+            timer_queue_type(kTimerQueueSet),
+            use_timerfd(false)
+        { }
+
+        PollerType     poller_type;
+        TimerQueueType timer_queue_type;
+
+        // drive timers from a timerfd armed to the earliest deadline, the loop
+        // then blocks indefinitely instead of polling with a millisecond timeout
+        bool use_timerfd;
+    };
 
     class EventLoop : noncopyable
     {
     public:
-        EventLoop();
+        // length of the windows busy time is summed over, in microseconds
+        static const int64_t kBusyWindow = 100 * 1000;
+
+        explicit EventLoop(const EventLoopOptions& options = EventLoopOptions());
         ~EventLoop();
 
         void Loop();
@@ -31,26 +53,96 @@ namespace buzz
         TimerId RunAt(const Timestamp& time, TaskCallback&& task);
         TimerId RunAfter(double delay, TaskCallback&& task);
         TimerId RunEvery(double interval, TaskCallback&& task);
+        void Cancel(TimerId timer_id);
 
         Poller* GetPoller() { return m_poller.get(); }
-        void RunInLoop(const TaskCallback&& task);
+
+        // monotonic time read once per iteration after Poll returns, loop thread
+        // only. use it for intervals and deadlines, not for display
+        Timestamp Now() const { return m_now; }
+
+        // wall clock time of the current iteration, derived from Now() with an
+        // offset resampled at most once a second
+        Timestamp PollReturnTime() const { return m_poll_return_time; }
+
+        // chunks for the ChainBuffers of connections on this loop
+        ChunkPool* GetChunkPool() { return m_chunk_pool.get(); }
+
+        // overflow area shared by the input buffers of this loop's connections
+        ReadScratch* GetReadScratch() { return &m_read_scratch; }
+
+        // connection timeouts of this loop, created on first use in the loop thread
+        TimeoutWheel* Timeouts();
+
+        void RunInLoop(TaskCallback&& task);
+        void QueueInLoop(TaskCallback&& task);
+
+        // runs task once this iteration's events, posted tasks and timers are
+        // handled, right before the next Poll. loop thread only
+        void RunAtIterationEnd(TaskCallback&& task);
+
+        // eventfd writes skipped because a wakeup was already pending
+        uint64_t WakeupsSaved() const { return m_wakeups_saved.load(std::memory_order_relaxed); }
+
+        // load counters read from any thread to place new connections. the
+        // count is kept by whoever hands connections to the loop
+        void AddConnections(int64_t delta) { m_connections.fetch_add(delta, std::memory_order_relaxed); }
+        int64_t Connections() const { return m_connections.load(std::memory_order_relaxed); }
+
+        // microseconds spent handling events, tasks and timers in the current
+        // and the previous kBusyWindow before now (monotonic microseconds),
+        // 0 once the loop has been idle for longer
+        int64_t RecentBusyTime(int64_t now) const;
     private:
+        struct PendingTask;
+
         pid_t m_thread_id;
         bool  m_exited;
         bool  m_looping;
+
+        // declared first so it is destroyed last, pending timers and tasks may
+        // hold the last reference to a connection allocated from it
+        std::unique_ptr<ChunkPool> m_chunk_pool;
         
         std::unique_ptr<Poller> m_poller;
         std::vector<Channel*>   m_active_channel;
         TimerManager            m_timer_manager;
 
         Channel*  m_wakeup_channel;
+
+        Timestamp m_now;
         Timestamp m_poll_return_time;
+        Timestamp m_wall_sampled;
+        int64_t   m_wall_offset;
         
-        BlockingQueue<TaskCallback> m_tasks;
+        MpscQueue<PendingTask>    m_tasks;
+        std::vector<PendingTask*> m_pending_batch;
+
+        std::vector<TaskCallback> m_iteration_end_tasks;
+        std::vector<TaskCallback> m_iteration_end_batch;
+
+        int m_wakeup_fd;
+
+        std::atomic<bool>     m_wakeup_pending;
+        std::atomic<uint64_t> m_wakeups_saved;
+
+        std::atomic<int64_t> m_connections;
+
+        // written by the loop thread alone, read approximately by others
+        std::atomic<int64_t> m_busy_window;
+        std::atomic<int64_t> m_busy_current;
+        std::atomic<int64_t> m_busy_previous;
+
+        ReadScratch                   m_read_scratch;
+        std::unique_ptr<TimeoutWheel> m_timeouts;
 
-        int m_wakeup_pipe[2];
+        void UpdateTime();
+        void RecordBusyTime();
 
         void Wakeup();
+        void HandleWakeup();
+        void DoPendingTasks();
+        void DoIterationEndTasks();
         void AbortNotInLoopThread();
     };
 }
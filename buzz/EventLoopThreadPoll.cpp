@@ -1,10 +1,25 @@
 #include "EventLoop.h"
+#include "Timestamp.h"
 #include "EventLoopThreadPoll.h"
 
+#include <mutex>
+#include <condition_variable>
+
 #include <assert.h>
+#include <stdint.h>
 
 using namespace buzz;
 
+// splitmix64 finalizer, spreads a counter into random-looking bits
+static uint64_t Mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+    return x ^ (x >> 31);
+}
+
 class buzz::EventLoopThread
 {
 public:
@@ -49,12 +64,13 @@ EventLoopThreadPoll::~EventLoopThreadPoll()
         delete m_threads[i];
     }
 }
-void EventLoopThreadPoll::Start(size_t poll_size)
+void EventLoopThreadPoll::Start(size_t poll_size, SelectPolicy policy)
 {
     assert(m_loop_start == false);
     m_loop_start = true;
 
     m_event_poll_size = poll_size;
+    m_policy = policy;
 
     for (size_t i = 0; i < m_event_poll_size; i++) {
         auto t = new EventLoopThread();
@@ -66,9 +82,83 @@ void EventLoopThreadPoll::Start(size_t poll_size)
 
 EventLoop* EventLoopThreadPoll::Get()
 {
-    if (m_event_poll_size) {
+    if (m_event_poll_size == 0) return m_base_loop;
+
+    switch (m_policy) {
+    case kLeastConnections:
+        return GetLeastConnections();
+    case kLeastBusy:
+        return GetLeastBusy();
+    case kPowerOfTwoChoices:
+        return GetPowerOfTwoChoices();
+    default:
         return m_event_loops[m_id++ % m_event_poll_size];
     }
-    
-    return m_base_loop;
+}
+
+// the scans start where the last one did so ties rotate
+EventLoop* EventLoopThreadPoll::GetLeastConnections()
+{
+    size_t start = m_id++ % m_event_poll_size;
+
+    EventLoop* best = m_event_loops[start];
+    int64_t best_connections = best->Connections();
+
+    for (size_t i = 1; i < m_event_poll_size && best_connections > 0; i++) {
+        EventLoop* loop = m_event_loops[(start + i) % m_event_poll_size];
+        int64_t connections = loop->Connections();
+
+        if (connections < best_connections) {
+            best = loop;
+            best_connections = connections;
+        }
+    }
+
+    return best;
+}
+
+EventLoop* EventLoopThreadPoll::GetLeastBusy()
+{
+    size_t start = m_id++ % m_event_poll_size;
+    int64_t now = Timestamp::Monotonic().MicroSecondsSinceEpoch();
+
+    EventLoop* best = m_event_loops[start];
+    int64_t best_busy = best->RecentBusyTime(now);
+
+    for (size_t i = 1; i < m_event_poll_size && best_busy > 0; i++) {
+        EventLoop* loop = m_event_loops[(start + i) % m_event_poll_size];
+        int64_t busy = loop->RecentBusyTime(now);
+
+        if (busy < best_busy) {
+            best = loop;
+            best_busy = busy;
+        }
+    }
+
+    return best;
+}
+
+EventLoop* EventLoopThreadPoll::GetPowerOfTwoChoices()
+{
+    if (m_event_poll_size == 1) return m_event_loops[0];
+
+    uint64_t r = Mix(m_id++);
+
+    // two distinct loops
+    size_t a = r % m_event_poll_size;
+    size_t b = (a + 1 + (r >> 32) % (m_event_poll_size - 1)) % m_event_poll_size;
+
+    EventLoop* first = m_event_loops[a];
+    EventLoop* second = m_event_loops[b];
+
+    return second->Connections() < first->Connections() ? second : first;
+}
+
+std::vector<EventLoop*> EventLoopThreadPoll::GetAll()
+{
+    if (m_event_poll_size) {
+        return m_event_loops;
+    }
+
+    return std::vector<EventLoop*>(1, m_base_loop);
 }
\ No newline at end of file
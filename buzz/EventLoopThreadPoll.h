@@ -13,10 +13,19 @@ namespace buzz
     class EventLoopThreadPoll
     {
     public:
+        // how Get picks a loop. kRoundRobin: in turn. kLeastConnections: the
+        // loop with the fewest connections. kLeastBusy: the loop that spent
+        // the least time handling events lately, for connections of uneven
+        // weight. kPowerOfTwoChoices: the one with fewer connections of two
+        // loops picked at random, close to the least loaded without reading
+        // every loop's counters. ties go round-robin
+        enum SelectPolicy { kRoundRobin, kLeastConnections, kLeastBusy, kPowerOfTwoChoices };
+
         EventLoopThreadPoll(EventLoop* base_loop)
             : m_base_loop(base_loop),
             m_loop_start(false),
             m_event_poll_size(0), 
+            m_policy(kRoundRobin),
             m_id(0),
             m_event_loops(0),
             m_threads(0)
@@ -24,18 +33,26 @@ namespace buzz
 
         ~EventLoopThreadPoll();
 
-        void Start(size_t poll_size = 0);
+        void Start(size_t poll_size = 0, SelectPolicy policy = kRoundRobin);
         
         EventLoop* Get();
+
+        // every loop Get may return, the base loop alone when no threads were started
+        std::vector<EventLoop*> GetAll();
     private:
         EventLoop*   m_base_loop;
 
-        bool   m_loop_start;
-        size_t m_event_poll_size;
+        bool         m_loop_start;
+        size_t       m_event_poll_size;
+        SelectPolicy m_policy;
 
         std::atomic_ullong       m_id;
         std::vector<EventLoop* > m_event_loops;
 
         std::vector<EventLoopThread*> m_threads;
+
+        EventLoop* GetLeastConnections();
+        EventLoop* GetLeastBusy();
+        EventLoop* GetPowerOfTwoChoices();
     };
 }
\ No newline at end of file
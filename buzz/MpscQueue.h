@@ -0,0 +1,89 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+
+namespace buzz
+{
+    struct MpscNode
+    {
+        MpscNode() : m_next(nullptr)
+        { }
+
+        std::atomic<MpscNode*> m_next;
+    };
+
+    //
+    // intrusive lock-free multi-producer / single-consumer queue (D. Vyukov).
+    // T must derive from MpscNode. Push may be called from any thread,
+    // Pop only from the single consumer thread.
+    //
+    template<typename T>
+    class MpscQueue : noncopyable
+    {
+    public:
+        MpscQueue() : m_head(&m_stub), m_tail(&m_stub)
+        { }
+
+        void Push(T* elem) { PushNode(static_cast<MpscNode*>(elem)); }
+
+        T* Pop()
+        {
+            MpscNode* tail = m_tail;
+            MpscNode* next = tail->m_next.load(std::memory_order_acquire);
+
+            if (tail == &m_stub) {
+                if (next == nullptr) {
+                    return nullptr;
+                }
+
+                m_tail = next;
+                tail = next;
+                next = next->m_next.load(std::memory_order_acquire);
+            }
+
+            if (next) {
+                m_tail = next;
+                return static_cast<T*>(tail);
+            }
+
+            // a producer has swapped m_head but not linked its node yet,
+            // it will wake the consumer again once it is done
+            if (tail != m_head.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+
+            PushNode(&m_stub);
+
+            next = tail->m_next.load(std::memory_order_acquire);
+            if (next) {
+                m_tail = next;
+                return static_cast<T*>(tail);
+            }
+
+            return nullptr;
+        }
+
+        // consumer side only
+        bool Empty() const
+        {
+            return m_tail == &m_stub &&
+                   m_stub.m_next.load(std::memory_order_acquire) == nullptr;
+        }
+
+    private:
+        alignas(64) std::atomic<MpscNode*> m_head;
+        alignas(64) MpscNode* m_tail;
+
+        MpscNode m_stub;
+
+        void PushNode(MpscNode* node)
+        {
+            node->m_next.store(nullptr, std::memory_order_relaxed);
+
+            MpscNode* prev = m_head.exchange(node, std::memory_order_acq_rel);
+            prev->m_next.store(node, std::memory_order_release);
+        }
+    };
+}
@@ -0,0 +1,29 @@
+#include "Poller.h"
+#include "Logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace buzz;
+
+Poller* buzz::MakePoller(PollerType type)
+{
+    if (type == kPollerDefault) {
+        const char* env = ::getenv("BUZZ_POLLER");
+
+        if (env && ::strcmp(env, "uring") == 0) {
+            type = kPollerUring;
+        } else {
+            type = kPollerEpoll;
+        }
+    }
+
+    if (type == kPollerUring) {
+        Poller* poller = MakePollerUring();
+        if (poller) return poller;
+
+        LOG(WARN) << "io_uring poller unsupported by kernel, falling back to epoll";
+    }
+
+    return MakePollerEpoll();
+}
@@ -7,7 +7,8 @@
 namespace buzz
 {
     class Channel;
-    class Timestamp;
+
+    enum PollerType { kPollerDefault, kPollerEpoll, kPollerUring };
 
     class Poller : noncopyable
     {
@@ -18,12 +19,20 @@ namespace buzz
 
         virtual ~Poller() { }
 
-        virtual Timestamp Poll(int timeout, ChannelList* active_events) = 0;
+        // the caller reads the clock once after Poll returns, see EventLoop::Now
+        virtual void Poll(int timeout, ChannelList* active_events) = 0;
 
         virtual void AddChannel(Channel* channel) = 0;
         virtual void UpdateChannel(Channel* channel) = 0;
         virtual void RemoveChannel(Channel* channel) = 0;
+
+        virtual bool HasChannel(Channel* channel) const = 0;
     };
 
-    Poller* MakePoller();
+    // kPollerDefault reads BUZZ_POLLER ("epoll" or "uring") from the environment,
+    // io_uring falls back to epoll when the kernel lacks support
+    Poller* MakePoller(PollerType type = kPollerDefault);
+
+    Poller* MakePollerEpoll();
+    Poller* MakePollerUring();
 }
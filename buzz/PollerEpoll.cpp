@@ -1,9 +1,9 @@
 #include "Poller.h"
 #include "Logger.h"
 #include "Channel.h"
+#include "EventLoop.h"
 #include "Timestamp.h"
 
-#include <set>
 #include <vector>
 
 #include <unistd.h>
@@ -14,6 +14,9 @@ namespace buzz
 {
     const int kReadEvent  = EPOLLIN;
     const int kWriteEvent = EPOLLOUT;
+    const int kEdgeTriggered = EPOLLET;
+    const int kErrorEvent = EPOLLERR;
+    const int kExclusive  = EPOLLEXCLUSIVE;
 
     class PollerEpoll : public Poller
     {
@@ -21,17 +24,27 @@ namespace buzz
         PollerEpoll();
         ~PollerEpoll();
 
-        Timestamp Poll(int timeout, ChannelList* active_events) override;
+        void Poll(int timeout, ChannelList* active_events) override;
 
         void AddChannel(Channel* channel)    override;
         void UpdateChannel(Channel* channel) override;
         void RemoveChannel(Channel* channel) override;
 
+        bool HasChannel(Channel* channel) const override;
+
     private:
         int m_epfd;
 
-        std::set<Channel*>              m_channels;
+        std::vector<Channel*>           m_channels; // indexed by fd
+        std::vector<Channel*>           m_pending_updates;
         std::vector<struct epoll_event> m_active_events;
+
+        void ApplyUpdates();
+
+        static bool Interested(int events)
+        {
+            return events & (kReadEvent | kWriteEvent);
+        }
     };
 
     PollerEpoll::PollerEpoll()
@@ -49,13 +62,18 @@ namespace buzz
     {
         LOG(DEBUG) << "destroying PollerEpoll " << m_epfd;
 
-        for (auto it : m_channels) { delete it; }
+        for (size_t fd = 0; fd < m_channels.size(); fd++) {
+            if (m_channels[fd]) delete m_channels[fd];
+        }
+
         ::close(m_epfd);
     }
 
-    Timestamp PollerEpoll::Poll(int timeout, ChannelList* active_events)
+    void PollerEpoll::Poll(int timeout, ChannelList* active_events)
     {
         assert(active_events);
+
+        ApplyUpdates();
         
         int nready = epoll_wait(m_epfd, m_active_events.data(), m_active_events.size(), timeout);
 
@@ -63,8 +81,6 @@ namespace buzz
             LOG(FATAL) << "epoll_wait reutrn " << nready << " (" << ::strerror(errno) << ')';
         }
 
-        Timestamp now(Timestamp::Now());
-
         for (int i = 0; i < nready; i++) {
             Channel* channel = static_cast<Channel*>(m_active_events[i].data.ptr);
             channel->SetRevents(m_active_events[i].events);
@@ -75,65 +91,114 @@ namespace buzz
         if (static_cast<size_t>(nready) == m_active_events.size()) {
             m_active_events.resize(nready << 1);
         }
-
-        return now;
     }
 
     void PollerEpoll::AddChannel(Channel* channel)
     {
         assert(channel);
-        
-        struct epoll_event ev[1];
-        ev[0].data.ptr = channel;
-        ev[0].events = channel->GetEvents();
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+
+        size_t fd = channel->GetFd();
+        if (fd >= m_channels.size()) {
+            m_channels.resize(std::max(fd + 1, m_channels.size() * 2), NULL);
+        }
+
+        assert(m_channels[fd] == NULL);
 
         LOG(TRACE) << "adding channel " << channel->GetId()
                    << " fd " << channel->GetFd()
                    << " events " << channel->GetEvents() << " epoll " << m_epfd;
 
-        int ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD,channel->GetFd(), ev);
-        if (ret == -1) {
-            LOG(FATAL) << "epoll_ctl add failed " << errno << " (" << strerror(errno) << ')';
-        }
-
-        m_channels.insert(channel);
+        m_channels[fd] = channel;
+        m_pending_updates.push_back(channel);
     }
 
     void PollerEpoll::UpdateChannel(Channel* channel)
     {
         assert(channel);
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+        assert(HasChannel(channel));
 
-        struct epoll_event ev[1];
-        ev[0].data.ptr = channel;
-        ev[0].events = channel->GetEvents();
-
-        LOG(TRACE) << "modifying channel " << channel->GetId()
-                   << " fd " << channel->GetFd()
-                   << " events " << channel->GetEvents() << " epoll " << m_epfd;
-
-        int ret = epoll_ctl(m_epfd, EPOLL_CTL_MOD, channel->GetFd(), ev);
-        if (ret == -1) {
-            LOG(FATAL) << "epoll_ctl mod failed " << errno << " (" << strerror(errno) << ')';
-        }
+        m_pending_updates.push_back(channel);
     }
 
     void PollerEpoll::RemoveChannel(Channel* channel)
     {
         assert(channel);
-
-        struct epoll_event ev[1];
-        ev[0].data.ptr = channel;
-        ev[0].events = channel->GetEvents();
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+        assert(HasChannel(channel));
 
         LOG(TRACE) << "deleting channel " << channel->GetId()
                    << " fd " << channel->GetFd()
                    << " epoll " << m_epfd;
 
+        if (Interested(channel->GetRegisteredEvents())) {
+            struct epoll_event ev[1];
+            ev[0].data.ptr = channel;
+            ev[0].events = kNoneEvent;
+
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, channel->GetFd(), ev);
+            channel->SetRegisteredEvents(kNoneEvent);
+        }
+
+        if (channel->UpdatePending()) {
+            for (size_t i = 0; i < m_pending_updates.size(); i++) {
+                if (m_pending_updates[i] == channel) m_pending_updates[i] = NULL;
+            }
+        }
+
+        m_channels[channel->GetFd()] = NULL;
+    }
+
+    void PollerEpoll::ApplyUpdates()
+    {
+        for (size_t i = 0; i < m_pending_updates.size(); i++) {
+            Channel* channel = m_pending_updates[i];
+            if (channel == NULL) continue;
+
+            channel->SetUpdatePending(false);
+
+            int events = channel->GetEvents();
+            int registered = channel->GetRegisteredEvents();
+
+            // toggled back and forth within this iteration
+            if (events == registered) continue;
+
+            int op;
+            if (Interested(events)) {
+                op = Interested(registered) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            } else if (Interested(registered)) {
+                op = EPOLL_CTL_DEL;
+                events = kNoneEvent;
+            } else {
+                continue;
+            }
+
+            struct epoll_event ev[1];
+            ev[0].data.ptr = channel;
+            ev[0].events = events;
+
+            LOG(TRACE) << "applying channel " << channel->GetId()
+                       << " fd " << channel->GetFd()
+                       << " events " << events << " op " << op << " epoll " << m_epfd;
+
+            int ret = epoll_ctl(m_epfd, op, channel->GetFd(), ev);
+            if (ret == -1) {
+                LOG(FATAL) << "epoll_ctl op " << op << " failed " << errno
+                           << " (" << strerror(errno) << ')';
+            }
+
+            channel->SetRegisteredEvents(events);
+        }
 
-        epoll_ctl(m_epfd, EPOLL_CTL_DEL, channel->GetFd(), ev);
+        m_pending_updates.clear();
+    }
 
-        m_channels.erase(channel);
+    bool PollerEpoll::HasChannel(Channel* channel) const
+    {
+        size_t fd = channel->GetFd();
+        return fd < m_channels.size() && m_channels[fd] == channel;
     }
 
-    Poller* MakePoller() { return new PollerEpoll(); }
+    Poller* MakePollerEpoll() { return new PollerEpoll(); }
 }
\ No newline at end of file
@@ -0,0 +1,722 @@
+#include "Poller.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Channel.h"
+#include "EventLoop.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <poll.h>
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+
+namespace buzz
+{
+    static_assert(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT,
+                  "io_uring poll masks must match kReadEvent/kWriteEvent");
+
+    //
+    // readiness poller on top of io_uring IORING_OP_POLL_ADD.
+    // every channel has at most one poll request in flight. level-triggered
+    // channels get a one-shot poll that is re-armed on the next Poll after it
+    // fired, which keeps the semantics of PollerEpoll. kEdgeTriggered channels
+    // drain until EAGAIN, so they get a multishot poll (IORING_POLL_ADD_MULTI)
+    // that stays armed and is only re-armed once the kernel drops it (no
+    // IORING_CQE_F_MORE), or when the events change. kExclusive is ignored.
+    // arming, cancelling and waiting are submitted together by a single
+    // io_uring_enter per loop iteration.
+    //
+    // the read side of a channel that asks for completions is not polled. a
+    // listener gets a multishot accept, a connection a multishot recv that
+    // picks buffers from a ring registered with the kernel, the received bytes
+    // are copied into the channel's buffer and the ring buffer handed back at
+    // once. the results are queued on the channel, which is reported readable.
+    // pausing a read cancels the op, what still arrives meanwhile is queued
+    // all the same. without kernel support channels fall back to readiness.
+    //
+    class PollerUring : public Poller
+    {
+    public:
+        PollerUring();
+        ~PollerUring();
+
+        bool Init(unsigned entries);
+
+        void Poll(int timeout, ChannelList* active_events) override;
+
+        void AddChannel(Channel* channel)    override;
+        void UpdateChannel(Channel* channel) override;
+        void RemoveChannel(Channel* channel) override;
+
+        bool HasChannel(Channel* channel) const override;
+
+    private:
+        struct Entry
+        {
+            Entry() : m_channel(NULL), m_generation(0), m_op_generation(0), m_armed_events(0),
+                m_op(kCompletionNone), m_armed(false), m_armed_multishot(false),
+                m_op_cancelled(false), m_queued(false), m_active(false)
+            { }
+
+            Channel*     m_channel;
+            uint32_t     m_generation;
+            uint32_t     m_op_generation;
+            int          m_armed_events;
+            CompletionOp m_op;
+            bool         m_armed;
+            bool         m_armed_multishot;
+            bool         m_op_cancelled;
+            bool         m_queued;
+            bool         m_active;
+        };
+
+        static const uint64_t kIgnoreUserData = UINT64_MAX;
+        static const uint32_t kGenerationMask = 0x3fffffff;
+
+        // provided buffers for multishot recv, a power of two of them
+        static const unsigned kBufferGroup = 0;
+        static const unsigned kBufferCount = 128;
+        static const size_t   kBufferSize  = 8 * 1024;
+
+        int  m_ring_fd;
+        bool m_multishot;
+        bool m_multishot_accept;
+        bool m_multishot_recv;
+
+        void*  m_sq_ring;
+        void*  m_cq_ring;
+        size_t m_sq_ring_size;
+        size_t m_cq_ring_size;
+
+        struct io_uring_sqe* m_sqes;
+        size_t               m_sqes_size;
+
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned  m_sq_mask;
+        unsigned  m_sq_entries;
+        unsigned  m_sq_local_tail;
+
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        unsigned  m_cq_mask;
+        struct io_uring_cqe* m_cqes;
+
+        // the ring is indexed as a plain array, its flexible member sits past
+        // an empty struct in C++. the tail overlays the first entry
+        struct io_uring_buf* m_buf_ring;
+        char*                m_bufs;
+        uint16_t             m_buf_tail;
+
+        std::vector<Entry> m_entries;
+        std::vector<int>   m_rearm;
+
+        struct io_uring_sqe* GetSqe();
+        unsigned ToSubmit();
+        void Flush();
+
+        void Queue(int fd);
+        void CancelPoll(int fd);
+
+        void ArmOp(int fd, CompletionOp op);
+        void CancelOp(int fd);
+        void Complete(const struct io_uring_cqe* cqe, ChannelList* active_events);
+        void Activate(Entry& entry, int revents, ChannelList* active_events);
+
+        bool SetupBuffers();
+        void RecycleBuffer(uint16_t bid);
+
+        CompletionOp WantedOp(Channel* channel);
+
+        static int PollEvents(Channel* channel)
+        {
+            return channel->GetEvents() & (kReadEvent | kWriteEvent);
+        }
+
+        bool Multishot(Channel* channel) const
+        {
+            return m_multishot && (channel->GetEvents() & kEdgeTriggered);
+        }
+
+        // the op in the top bits, kCompletionNone for a poll
+        static uint64_t UserData(int fd, uint32_t generation, CompletionOp op = kCompletionNone)
+        {
+            return (static_cast<uint64_t>(fd) << 32) | (static_cast<uint32_t>(op) << 30) |
+                   (generation & kGenerationMask);
+        }
+    };
+
+    static int IoUringSetup(unsigned entries, struct io_uring_params* params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    static int IoUringRegister(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+    }
+
+    static int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                            unsigned flags, const void* arg, size_t arg_size)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                          min_complete, flags, arg, arg_size));
+    }
+
+    PollerUring::PollerUring()
+        : m_ring_fd(-1),
+        m_multishot(true),
+        m_multishot_accept(true),
+        m_multishot_recv(true),
+        m_sq_ring(MAP_FAILED),
+        m_cq_ring(MAP_FAILED),
+        m_sq_ring_size(0),
+        m_cq_ring_size(0),
+        m_sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        m_sqes_size(0),
+        m_sq_local_tail(0),
+        m_buf_ring(static_cast<struct io_uring_buf*>(MAP_FAILED)),
+        m_bufs(static_cast<char*>(MAP_FAILED)),
+        m_buf_tail(0)
+    { }
+
+    PollerUring::~PollerUring()
+    {
+        LOG(DEBUG) << "destroying PollerUring " << m_ring_fd;
+
+        for (size_t fd = 0; fd < m_entries.size(); fd++) {
+            if (m_entries[fd].m_channel) delete m_entries[fd].m_channel;
+        }
+
+        if (m_sqes != MAP_FAILED) ::munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) ::munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring != MAP_FAILED) ::munmap(m_sq_ring, m_sq_ring_size);
+
+        if (m_ring_fd != -1) ::close(m_ring_fd);
+
+        // the kernel lets go of the provided buffers with the ring
+        if (m_bufs != MAP_FAILED) ::munmap(m_bufs, kBufferCount * kBufferSize);
+        if (m_buf_ring != MAP_FAILED) ::munmap(m_buf_ring, kBufferCount * sizeof(struct io_uring_buf));
+    }
+
+    bool PollerUring::Init(unsigned entries)
+    {
+        struct io_uring_params params;
+        ::memset(&params, 0, sizeof(params));
+
+        m_ring_fd = IoUringSetup(entries, &params);
+        if (m_ring_fd == -1) {
+            LOG(DEBUG) << "io_uring_setup error " << errno << " (" << ::strerror(errno) << ')';
+            return false;
+        }
+
+        const unsigned required = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if ((params.features & required) != required) {
+            LOG(DEBUG) << "io_uring lacks required features " << params.features;
+            return false;
+        }
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+
+        m_sq_ring = ::mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED) return false;
+
+        if (single_mmap) {
+            m_cq_ring = m_sq_ring;
+        } else {
+            m_cq_ring = ::mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ring == MAP_FAILED) return false;
+        }
+
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = static_cast<struct io_uring_sqe*>(
+            ::mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+        if (m_sqes == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(m_sq_ring);
+        char* cq = static_cast<char*>(m_cq_ring);
+
+        m_sq_head    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_sq_tail    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sq_mask    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+
+        unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < m_sq_entries; i++) {
+            sq_array[i] = i;
+        }
+
+        m_sq_local_tail = *m_sq_tail;
+
+        m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes    = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        LOG(DEBUG) << "poller io_uring " << m_ring_fd << " created";
+
+        return true;
+    }
+
+    void PollerUring::Poll(int timeout, ChannelList* active_events)
+    {
+        assert(active_events);
+
+        for (size_t i = 0; i < m_rearm.size(); i++) {
+            Entry& entry = m_entries[m_rearm[i]];
+            entry.m_queued = false;
+
+            Channel* channel = entry.m_channel;
+            if (channel == NULL) continue;
+
+            // the read side of a completion channel is served by its op
+            CompletionOp op = WantedOp(channel);
+
+            int events = PollEvents(channel);
+            if (op != kCompletionNone) events &= ~kReadEvent;
+
+            bool multishot = Multishot(channel);
+
+            channel->SetUpdatePending(false);
+            channel->SetRegisteredEvents(channel->GetEvents());
+            channel->SetCompleting(op != kCompletionNone);
+
+            // one op in flight at most, a cancelled one is replaced once its
+            // last completion arrives, which queues the channel again
+            if (entry.m_op != kCompletionNone && entry.m_op != op && entry.m_op_cancelled == false) {
+                CancelOp(m_rearm[i]);
+            }
+
+            if (entry.m_op == kCompletionNone && op != kCompletionNone) {
+                ArmOp(m_rearm[i], op);
+            }
+
+            if (entry.m_armed) {
+                if (entry.m_armed_events == events && entry.m_armed_multishot == multishot) continue;
+                CancelPoll(m_rearm[i]);
+            }
+
+            if (events == kNoneEvent) continue;
+
+            struct io_uring_sqe* sqe = GetSqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = m_rearm[i];
+            sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+            sqe->poll32_events = events;
+            sqe->user_data = UserData(m_rearm[i], entry.m_generation);
+
+            entry.m_armed = true;
+            entry.m_armed_events = events;
+            entry.m_armed_multishot = multishot;
+        }
+
+        m_rearm.clear();
+
+        __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        ::memset(&arg, 0, sizeof(arg));
+
+        if (timeout > 0) {
+            ts.tv_sec  = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000 * 1000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+
+        int ret = IoUringEnter(m_ring_fd, ToSubmit(), timeout == 0 ? 0 : 1,
+                               IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                               &arg, sizeof(arg));
+
+        if (ret == -1 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+            LOG(FATAL) << "io_uring_enter return " << ret << " (" << ::strerror(errno) << ')';
+        }
+
+        const size_t first_active = active_events->size();
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            const struct io_uring_cqe* cqe = &m_cqes[head & m_cq_mask];
+            if (cqe->user_data == kIgnoreUserData) continue;
+
+            if (((cqe->user_data >> 30) & 3) != kCompletionNone) {
+                Complete(cqe, active_events);
+                continue;
+            }
+
+            int fd = static_cast<int>(cqe->user_data >> 32);
+            uint32_t generation = static_cast<uint32_t>(cqe->user_data) & kGenerationMask;
+
+            if (static_cast<size_t>(fd) >= m_entries.size()) continue;
+
+            Entry& entry = m_entries[fd];
+            if (entry.m_channel == NULL || (entry.m_generation & kGenerationMask) != generation ||
+                !entry.m_armed) {
+                continue;
+            }
+
+            // a multishot poll stays armed as long as the kernel sets F_MORE
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                entry.m_armed = false;
+                Queue(fd);
+            }
+
+            if (cqe->res == -EINVAL && entry.m_armed_multishot) {
+                LOG(WARN) << "io_uring multishot poll not supported, using one-shot polls";
+                m_multishot = false;
+                continue;
+            }
+
+            if (cqe->res < 0) {
+                LOG(ERROR) << "io_uring poll fd " << fd << " error " << -cqe->res
+                           << " (" << ::strerror(-cqe->res) << ')';
+                continue;
+            }
+
+            Activate(entry, cqe->res, active_events);
+        }
+
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+        for (size_t i = first_active; i < active_events->size(); i++) {
+            m_entries[(*active_events)[i]->GetFd()].m_active = false;
+        }
+    }
+
+    void PollerUring::AddChannel(Channel* channel)
+    {
+        assert(channel);
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+
+        size_t fd = channel->GetFd();
+        if (fd >= m_entries.size()) {
+            m_entries.resize(std::max(fd + 1, m_entries.size() * 2));
+        }
+
+        LOG(TRACE) << "adding channel " << channel->GetId()
+                   << " fd " << fd
+                   << " events " << channel->GetEvents() << " io_uring " << m_ring_fd;
+
+        Entry& entry = m_entries[fd];
+        assert(entry.m_channel == NULL && entry.m_armed == false);
+
+        entry.m_channel = channel;
+        entry.m_generation++;
+
+        // an op of the fd's previous channel may still complete, it is told
+        // apart by the generation and left to finish
+        entry.m_op_generation++;
+        entry.m_op = kCompletionNone;
+        entry.m_op_cancelled = false;
+
+        channel->SetCompleting(false);
+
+        Queue(fd);
+    }
+
+    void PollerUring::UpdateChannel(Channel* channel)
+    {
+        assert(channel);
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+
+        assert(HasChannel(channel));
+
+        int fd = channel->GetFd();
+
+        LOG(TRACE) << "modifying channel " << channel->GetId()
+                   << " fd " << fd
+                   << " events " << channel->GetEvents() << " io_uring " << m_ring_fd;
+
+        Queue(fd);
+    }
+
+    void PollerUring::RemoveChannel(Channel* channel)
+    {
+        assert(channel);
+        assert(channel->GetOwnerLoop()->IsInLoopThread());
+
+        assert(HasChannel(channel));
+
+        int fd = channel->GetFd();
+        Entry& entry = m_entries[fd];
+
+        LOG(TRACE) << "deleting channel " << channel->GetId()
+                   << " fd " << fd
+                   << " io_uring " << m_ring_fd;
+
+        if (entry.m_armed) CancelPoll(fd);
+        if (entry.m_op != kCompletionNone && entry.m_op_cancelled == false) CancelOp(fd);
+
+        channel->SetCompleting(false);
+        entry.m_channel = NULL;
+    }
+
+    bool PollerUring::HasChannel(Channel* channel) const
+    {
+        size_t fd = channel->GetFd();
+        return fd < m_entries.size() && m_entries[fd].m_channel == channel;
+    }
+
+    struct io_uring_sqe* PollerUring::GetSqe()
+    {
+        if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries) {
+            Flush();
+        }
+
+        struct io_uring_sqe* sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+        ::memset(sqe, 0, sizeof(*sqe));
+
+        m_sq_local_tail++;
+
+        return sqe;
+    }
+
+    unsigned PollerUring::ToSubmit()
+    {
+        return m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    void PollerUring::Flush()
+    {
+        __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+        while (ToSubmit() == m_sq_entries) {
+            int ret = IoUringEnter(m_ring_fd, ToSubmit(), 0, 0, NULL, 0);
+            if (ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                LOG(FATAL) << "io_uring_enter submit error " << errno
+                           << " (" << ::strerror(errno) << ')';
+            }
+        }
+    }
+
+    void PollerUring::Queue(int fd)
+    {
+        Entry& entry = m_entries[fd];
+
+        if (entry.m_queued == false) {
+            entry.m_queued = true;
+            m_rearm.push_back(fd);
+        }
+    }
+
+    void PollerUring::CancelPoll(int fd)
+    {
+        Entry& entry = m_entries[fd];
+
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = UserData(fd, entry.m_generation);
+        sqe->user_data = kIgnoreUserData;
+
+        entry.m_armed = false;
+        entry.m_generation++;
+    }
+
+    void PollerUring::Activate(Entry& entry, int revents, ChannelList* active_events)
+    {
+        // a multishot poll or op may complete more than once per batch
+        if (entry.m_active) {
+            entry.m_channel->SetRevents(entry.m_channel->GetRevents() | revents);
+            return;
+        }
+
+        entry.m_active = true;
+        entry.m_channel->SetRevents(revents);
+        active_events->push_back(entry.m_channel);
+    }
+
+    // completions for a channel whose read side is served by an op. the fd's
+    // previous channel gets none, a connection it accepted is closed
+    void PollerUring::Complete(const struct io_uring_cqe* cqe, ChannelList* active_events)
+    {
+        int fd = static_cast<int>(cqe->user_data >> 32);
+        uint32_t generation = static_cast<uint32_t>(cqe->user_data) & kGenerationMask;
+        CompletionOp op = static_cast<CompletionOp>((cqe->user_data >> 30) & 3);
+
+        int res = cqe->res;
+        int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? cqe->flags >> IORING_CQE_BUFFER_SHIFT : -1;
+
+        Entry* entry = NULL;
+        if (static_cast<size_t>(fd) < m_entries.size() && m_entries[fd].m_channel &&
+            (m_entries[fd].m_op_generation & kGenerationMask) == generation) {
+            entry = &m_entries[fd];
+        }
+
+        if (entry == NULL) {
+            if (op == kCompletionAccept && res >= 0) ::close(res);
+            if (bid != -1) RecycleBuffer(bid);
+            return;
+        }
+
+        if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+            entry->m_op = kCompletionNone;
+            entry->m_op_cancelled = false;
+            Queue(fd);
+        }
+
+        if (res == -EINVAL) {
+            LOG(WARN) << "io_uring multishot " << (op == kCompletionAccept ? "accept" : "recv")
+                      << " not supported, polling for readiness";
+
+            if (op == kCompletionAccept) m_multishot_accept = false;
+            if (op == kCompletionRecv) m_multishot_recv = false;
+            return;
+        }
+
+        // cancelled, or out of provided buffers until the ones in use are
+        // handed back, re-armed on the next Poll either way
+        if (res == -ECANCELED || res == -ENOBUFS) return;
+
+        Channel* channel = entry->m_channel;
+
+        if (bid != -1) {
+            if (res > 0) {
+                assert(channel->GetCompletionBuffer());
+                channel->GetCompletionBuffer()->Append(m_bufs + bid * kBufferSize, res);
+            }
+            RecycleBuffer(bid);
+        }
+
+        channel->Completions().push_back(res);
+        Activate(*entry, kReadEvent, active_events);
+    }
+
+    void PollerUring::ArmOp(int fd, CompletionOp op)
+    {
+        Entry& entry = m_entries[fd];
+
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->fd = fd;
+        sqe->user_data = UserData(fd, entry.m_op_generation, op);
+
+        if (op == kCompletionAccept) {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = kBufferGroup;
+        }
+
+        entry.m_op = op;
+        entry.m_op_cancelled = false;
+    }
+
+    // the op keeps its generation, what it completes until the cancel lands
+    // still belongs to the channel
+    void PollerUring::CancelOp(int fd)
+    {
+        Entry& entry = m_entries[fd];
+
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = UserData(fd, entry.m_op_generation, entry.m_op);
+        sqe->user_data = kIgnoreUserData;
+
+        entry.m_op_cancelled = true;
+    }
+
+    CompletionOp PollerUring::WantedOp(Channel* channel)
+    {
+        if ((channel->GetEvents() & kReadEvent) == 0) return kCompletionNone;
+
+        switch (channel->GetCompletion()) {
+        case kCompletionAccept:
+            return m_multishot_accept ? kCompletionAccept : kCompletionNone;
+        case kCompletionRecv:
+            if (m_multishot_recv == false || channel->GetCompletionBuffer() == NULL) break;
+            return SetupBuffers() ? kCompletionRecv : kCompletionNone;
+        default:
+            break;
+        }
+
+        return kCompletionNone;
+    }
+
+    // registers the provided buffer ring on first use
+    bool PollerUring::SetupBuffers()
+    {
+        if (m_buf_ring != MAP_FAILED) return true;
+
+        const size_t ring_size = kBufferCount * sizeof(struct io_uring_buf);
+
+        void* ring = ::mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void* bufs = ::mmap(NULL, kBufferCount * kBufferSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        struct io_uring_buf_reg reg;
+        ::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = kBufferCount;
+        reg.bgid = kBufferGroup;
+
+        if (ring == MAP_FAILED || bufs == MAP_FAILED ||
+            IoUringRegister(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+            LOG(WARN) << "io_uring provided buffers unavailable " << errno
+                      << " (" << ::strerror(errno) << "), polling for readiness";
+
+            if (ring != MAP_FAILED) ::munmap(ring, ring_size);
+            if (bufs != MAP_FAILED) ::munmap(bufs, kBufferCount * kBufferSize);
+
+            m_multishot_recv = false;
+            return false;
+        }
+
+        m_buf_ring = static_cast<struct io_uring_buf*>(ring);
+        m_bufs = static_cast<char*>(bufs);
+
+        for (unsigned bid = 0; bid < kBufferCount; bid++) {
+            RecycleBuffer(static_cast<uint16_t>(bid));
+        }
+
+        return true;
+    }
+
+    void PollerUring::RecycleBuffer(uint16_t bid)
+    {
+        struct io_uring_buf* buf = &m_buf_ring[m_buf_tail & (kBufferCount - 1)];
+        buf->addr = reinterpret_cast<uint64_t>(m_bufs + bid * kBufferSize);
+        buf->len = kBufferSize;
+        buf->bid = bid;
+
+        m_buf_tail++;
+        __atomic_store_n(&reinterpret_cast<struct io_uring_buf_ring*>(m_buf_ring)->tail,
+                         m_buf_tail, __ATOMIC_RELEASE);
+    }
+
+    Poller* MakePollerUring()
+    {
+        PollerUring* poller = new PollerUring();
+
+        if (poller->Init(1024) == false) {
+            delete poller;
+            return NULL;
+        }
+
+        return poller;
+    }
+}
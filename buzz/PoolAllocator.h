@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ChunkPool.h"
+
+#include <stddef.h>
+
+namespace buzz
+{
+    //
+    // standard allocator over the size classes of a ChunkPool, for objects
+    // created and destroyed with every connection. the pool must outlive
+    // what is allocated from it. the loop declares its pool ahead of its
+    // timers and tasks, so connections they still hold are freed first.
+    //
+    template <typename T>
+    class PoolAllocator
+    {
+    public:
+        typedef T value_type;
+
+        explicit PoolAllocator(ChunkPool* pool) : m_pool(pool)
+        { }
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>& rhs) : m_pool(rhs.Pool())
+        { }
+
+        T* allocate(size_t n)
+        {
+            size_t capacity;
+            return reinterpret_cast<T*>(m_pool->Allocate(n * sizeof(T), &capacity));
+        }
+
+        void deallocate(T* p, size_t n)
+        {
+            m_pool->Free(reinterpret_cast<char*>(p), ChunkPool::Capacity(n * sizeof(T)));
+        }
+
+        ChunkPool* Pool() const { return m_pool; }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U>& rhs) const { return m_pool == rhs.Pool(); }
+
+        template <typename U>
+        bool operator!=(const PoolAllocator<U>& rhs) const { return m_pool != rhs.Pool(); }
+
+    private:
+        ChunkPool* m_pool;
+    };
+}
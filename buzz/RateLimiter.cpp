@@ -0,0 +1,69 @@
+#include "RateLimiter.h"
+
+#include <algorithm>
+
+using namespace buzz;
+
+void RateLimiter::SetRate(uint64_t bytes_per_second, uint64_t burst)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_burst = burst > 0 ? burst : bytes_per_second;
+
+    // a fresh limit starts with a full bucket, a changed one keeps its tokens
+    if (m_rate.load(std::memory_order_relaxed) == 0) {
+        m_tokens = static_cast<double>(m_burst);
+        m_last = 0;
+    } else {
+        m_tokens = std::min(m_tokens, static_cast<double>(m_burst));
+    }
+
+    m_rate.store(bytes_per_second, std::memory_order_relaxed);
+}
+
+uint64_t RateLimiter::Available(int64_t now)
+{
+    if (Limited() == false) return UINT64_MAX;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Refill(now);
+
+    return m_tokens > 0.0 ? static_cast<uint64_t>(m_tokens) : 0;
+}
+
+void RateLimiter::Consume(uint64_t bytes, int64_t now)
+{
+    if (Limited() == false) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Refill(now);
+
+    m_tokens -= static_cast<double>(bytes);
+}
+
+int64_t RateLimiter::Delay(int64_t now)
+{
+    uint64_t rate = m_rate.load(std::memory_order_relaxed);
+    if (rate == 0) return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Refill(now);
+
+    if (m_tokens >= 1.0) return 0;
+
+    return static_cast<int64_t>((1.0 - m_tokens) * 1000 * 1000 / rate) + 1;
+}
+
+// loops sharing the bucket read their clocks at different times, a call
+// with an earlier now than the last one adds nothing
+void RateLimiter::Refill(int64_t now)
+{
+    if (m_last == 0) m_last = now;
+    if (now <= m_last) return;
+
+    double rate = static_cast<double>(m_rate.load(std::memory_order_relaxed));
+
+    m_tokens = std::min(m_tokens + (now - m_last) * rate / (1000 * 1000),
+                        static_cast<double>(m_burst));
+    m_last = now;
+}
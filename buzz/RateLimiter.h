@@ -0,0 +1,53 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <mutex>
+#include <atomic>
+
+#include <stdint.h>
+
+namespace buzz
+{
+    //
+    // token bucket of bytes, refilled from the caller's clock on every call
+    // rather than by a timer, so each operation is O(1). a transfer may take
+    // more than what is left and leave the bucket in debt, Delay then tells
+    // how long until it is positive again. a rate of 0 means unlimited and
+    // costs one atomic load. may be shared by the connections of several
+    // loops, the bucket is locked then. times are monotonic microseconds.
+    //
+    class RateLimiter : noncopyable
+    {
+    public:
+        RateLimiter() : m_rate(0), m_burst(0), m_tokens(0.0), m_last(0)
+        { }
+
+        // bytes per second, and the most that may accumulate while idle
+        // (one second worth when 0). takes effect at once, 0 lifts the limit
+        void SetRate(uint64_t bytes_per_second, uint64_t burst = 0);
+
+        bool Limited() const { return m_rate.load(std::memory_order_relaxed) > 0; }
+
+        uint64_t Rate() const { return m_rate.load(std::memory_order_relaxed); }
+
+        // bytes that may be transferred now, 0 while in debt
+        uint64_t Available(int64_t now);
+
+        void Consume(uint64_t bytes, int64_t now);
+
+        // microseconds until bytes are available again, 0 if they are now
+        int64_t Delay(int64_t now);
+
+    private:
+        std::mutex m_mutex;
+
+        std::atomic<uint64_t> m_rate;
+        uint64_t              m_burst;
+
+        double  m_tokens;
+        int64_t m_last;
+
+        void Refill(int64_t now);
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <assert.h>
+#include <stddef.h>
+
+namespace buzz
+{
+    //
+    // refcounted view of bytes that are no longer written to: a range of
+    // memory kept alive by a shared owner. copies share the owner, so a
+    // slice moves between threads and into the output queue without
+    // copying the bytes.
+    //
+    class Slice
+    {
+    public:
+        Slice() : m_data(NULL), m_size(0)
+        { }
+
+        // data must stay valid while owner is alive
+        Slice(const char* data, size_t size, const std::shared_ptr<void>& owner)
+            : m_data(data), m_size(size), m_owner(owner)
+        { }
+
+        // takes over the string, its bytes are not copied
+        explicit Slice(std::string&& str)
+        {
+            std::shared_ptr<std::string> owner = std::make_shared<std::string>(std::move(str));
+
+            m_data = owner->data();
+            m_size = owner->size();
+            m_owner = std::move(owner);
+        }
+
+        // takes over the readable bytes of the buffer together with its storage
+        explicit Slice(Buffer&& buffer)
+        {
+            std::shared_ptr<Buffer> owner = std::make_shared<Buffer>(std::move(buffer));
+
+            m_data = owner->Peek();
+            m_size = owner->ReadableBytes();
+            m_owner = std::move(owner);
+        }
+
+        const char* Data() const { return m_data; }
+        size_t Size() const { return m_size; }
+        bool Empty() const { return m_size == 0; }
+
+        const std::shared_ptr<void>& Owner() const { return m_owner; }
+
+        // length bytes from offset, sharing the owner
+        Slice SubSlice(size_t offset, size_t length) const
+        {
+            assert(offset + length <= m_size);
+            return Slice(m_data + offset, length, m_owner);
+        }
+
+        void RemovePrefix(size_t n)
+        {
+            assert(n <= m_size);
+            m_data += n;
+            m_size -= n;
+        }
+
+    private:
+        const char* m_data;
+        size_t      m_size;
+
+        std::shared_ptr<void> m_owner;
+    };
+}
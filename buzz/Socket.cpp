@@ -22,7 +22,10 @@ int buzz::CreateNonBlockSocket()
     return sock_fd;
 }
 
-Socket::~Socket() { ::close(m_sock_fd); }
+Socket::~Socket()
+{
+    if (m_sock_fd != -1) ::close(m_sock_fd);
+}
 
 void Socket::Bind(InetAddress& local_addr)
 {
@@ -76,6 +79,16 @@ void Socket::ReuseAddr(bool on)
     }
 }
 
+void Socket::ReusePort(bool on)
+{
+    int opt = on ? 1 : 0;
+    int ret = ::setsockopt(m_sock_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    if (ret < 0) {
+        LOG(FATAL) << "SO_REUSEPORT failed " << errno << " ("
+                   << ::strerror(errno) << ')';
+    }
+}
+
 void Socket::TcpNoDelay(bool on)
 {
     int opt = on ? 1 : 0;
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "noncopyable.h"
 
 namespace buzz
@@ -14,6 +16,9 @@ namespace buzz
 
         int GetFd() const { return m_sock_fd; }
 
+        // gives up the fd without closing it
+        int Release() { int fd = m_sock_fd; m_sock_fd = -1; return fd; }
+
         void Listen();
         void Bind(InetAddress& local_addr);
         int  Accept(InetAddress& peer_addr);
@@ -22,6 +27,7 @@ namespace buzz
 
         void KeepAlive(bool on);
         void ReuseAddr(bool on);
+        void ReusePort(bool on);
         void TcpNoDelay(bool on);
     private:
         int m_sock_fd;
@@ -2,8 +2,13 @@
 #include "Logger.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "TimeoutWheel.h"
 #include "TcpConnection.h"
 
+#include <algorithm>
+
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/types.h>
@@ -11,30 +16,146 @@
 
 using namespace buzz;
 
-TcpConnection::TcpConnection(EventLoop* loop, const std::string& name, int clnt_fd, 
+namespace
+{
+    //
+    // zerocopy sends of a destroyed connection the kernel has not completed.
+    // keeps the socket open with its write side shut down, and the payload
+    // owners, until the completions are read off the error queue. polled on
+    // a timer backing off to a second, a half-closed socket would keep the
+    // poller reporting EPOLLHUP. completions always come, at the latest when
+    // tcp gives up on the peer. left alone if the loop ends first, the pages
+    // may still be in use then
+    //
+    class ZeroCopyLinger : noncopyable
+    {
+    public:
+        ZeroCopyLinger(EventLoop* loop, int fd)
+            : m_owner_loop(loop), m_sock(fd), m_pending(loop->GetChunkPool()), m_interval(0.001)
+        { }
+
+        ChainBuffer* Pending() { return &m_pending; }
+
+        // in the loop thread
+        void Reap()
+        {
+            m_pending.ReapZeroCopy(m_sock.GetFd());
+
+            if (m_pending.ZeroCopyPending() == 0) {
+                delete this;
+                return;
+            }
+
+            m_owner_loop->RunAfter(m_interval, [this] { Reap(); });
+            m_interval = std::min(m_interval * 2, 1.0);
+        }
+
+    private:
+        EventLoop*  m_owner_loop;
+        Socket      m_sock;
+        ChainBuffer m_pending;
+        double      m_interval;
+    };
+}
+
+// bytes both buckets allow now
+static uint64_t Allowance(RateLimiter* own, RateLimiter* shared, int64_t now)
+{
+    uint64_t allowance = own->Available(now);
+    if (shared) allowance = std::min(allowance, shared->Available(now));
+
+    return allowance;
+}
+
+static void Consume(RateLimiter* own, RateLimiter* shared, uint64_t bytes, int64_t now)
+{
+    own->Consume(bytes, now);
+    if (shared) shared->Consume(bytes, now);
+}
+
+static int64_t Delay(RateLimiter* own, RateLimiter* shared, int64_t now)
+{
+    int64_t delay = own->Delay(now);
+    if (shared) delay = std::max(delay, shared->Delay(now));
+
+    return delay;
+}
+
+TcpConnection::TcpConnection(EventLoop* loop, uint64_t id,
+                             const std::shared_ptr<const std::string>& name_prefix, int clnt_fd,
                              const InetAddress& local_addr,
                              const InetAddress& peer_addr)
     : m_owner_loop(loop),
-    m_name(name),
+    m_id(id),
+    m_name_prefix(name_prefix),
     m_state(kConnecting),
-    m_sock(new Socket(clnt_fd)),
-    m_channel(new Channel(loop, clnt_fd, kNoneEvent)),
+    m_sock(clnt_fd),
+    m_channel(loop, clnt_fd, kNoneEvent),
     m_local_addr(local_addr),
-    m_peer_addr(peer_addr)
+    m_peer_addr(peer_addr),
+    m_input_buffer(loop->GetChunkPool()),
+    m_output_buffer(loop->GetChunkPool()),
+    m_edge_triggered(false),
+    m_read_budget(kDefaultReadBudget),
+    m_coalesce_writes(false),
+    m_flush_scheduled(false),
+    m_high_water_mark(0),
+    m_low_water_mark(0),
+    m_pause_on_high_water(false),
+    m_above_high_water(false),
+    m_read_paused(0),
+    m_write_throttled(false),
+    m_idle_timeout(0),
+    m_read_timeout(0),
+    m_write_timeout(0),
+    m_reclaim_grace(0),
+    m_last_read(0),
+    m_last_write(0),
+    m_timeout_scheduled(false)
 {
-    m_sock->KeepAlive(true);
+    m_sock.KeepAlive(true);
     
-    m_channel->OnWrite(std::bind(&TcpConnection::HandleWrite, this));
-    m_channel->OnRead(std::bind(&TcpConnection::HandleRead, this, std::placeholders::_1));
+    // lambdas holding just this fit in std::function without allocating
+    m_channel.OnWrite([this] { HandleWrite(); });
+    m_channel.OnRead([this] (Timestamp receive_time) { HandleRead(receive_time); });
+    m_channel.OnError([this] { HandleError(); });
 
-    LOG(DEBUG) << "TcpConnection::TcpConnection [" << name << "] at fd " << clnt_fd;
+    // received into the input buffer by pollers that can, see UpdateCompletion
+    m_channel.SetCompletion(kCompletionRecv, &m_input_buffer);
+
+    LOG(DEBUG) << "TcpConnection::TcpConnection " << m_id << " from "
+               << m_peer_addr.ToString() << " at fd " << clnt_fd;
 }
 
 TcpConnection::~TcpConnection()
 {
-    LOG(DEBUG) << " TcpConnection::~TcpConnection [" << m_name << "] at " << this
-               << " fd " << m_sock->GetFd();
+    LOG(DEBUG) << " TcpConnection::~TcpConnection " << m_id << " at " << this
+               << " fd " << m_sock.GetFd();
     assert(m_state == kDisconnected);
+
+    // unsent zerocopy segments join the pending owners, which must outlive
+    // the connection while the kernel may read their pages
+    m_output_buffer.RetrieveAll();
+
+    if (m_output_buffer.ZeroCopyPending() > 0) {
+        int fd = m_sock.Release();
+        ::shutdown(fd, SHUT_WR);
+
+        ZeroCopyLinger* linger = new ZeroCopyLinger(m_owner_loop, fd);
+        m_output_buffer.MoveZeroCopyPending(linger->Pending());
+
+        m_owner_loop->QueueInLoop([linger] { linger->Reap(); });
+    }
+}
+
+// may be asked for from any thread
+const std::string& TcpConnection::Name() const
+{
+    std::call_once(m_name_once, [this] {
+        m_name = *m_name_prefix + '@' + std::to_string(m_id);
+    });
+
+    return m_name;
 }
 
 void TcpConnection::Close(double seconds)
@@ -53,6 +174,280 @@ void TcpConnection::Close(double seconds)
     }
 }
 
+void TcpConnection::SetTcpNoDelay(bool on)
+{
+    m_sock.TcpNoDelay(on);
+}
+
+void TcpConnection::SetHighWaterMark(size_t high, size_t low, bool pause_reading)
+{
+    assert(low <= high);
+
+    m_high_water_mark = high;
+    m_low_water_mark = low;
+    m_pause_on_high_water = pause_reading;
+}
+
+void TcpConnection::PauseReading()
+{
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::SetReadPaused, shared_from_this(),
+                                      kPausedByUser, true));
+}
+
+void TcpConnection::ResumeReading()
+{
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::SetReadPaused, shared_from_this(),
+                                      kPausedByUser, false));
+}
+
+void TcpConnection::SetReadPaused(int reason, bool paused)
+{
+    int before = m_read_paused;
+    m_read_paused = paused ? (m_read_paused | reason) : (m_read_paused & ~reason);
+
+    // a disconnecting connection still reads, the peer's FIN among it
+    if (m_state == kDisconnected || m_state == kConnecting) return;
+    if ((before == 0) == (m_read_paused == 0)) return;
+
+    if (m_read_paused) {
+        m_channel.EnableRead(false);
+        return;
+    }
+
+    m_channel.EnableRead(true);
+
+    // the read timeout does not count the time spent paused
+    m_last_read = m_owner_loop->Now().MicroSecondsSinceEpoch();
+
+    // an edge that came while paused was dropped by HandleRead, as were the
+    // results of receives the poller made meanwhile
+    if (m_edge_triggered || m_channel.Completions().empty() == false) {
+        m_owner_loop->QueueInLoop(std::bind(&TcpConnection::HandleRead, shared_from_this(),
+                                            m_owner_loop->PollReturnTime()));
+    }
+}
+
+void TcpConnection::SetReadRateLimit(uint64_t bytes_per_second, uint64_t burst)
+{
+    m_read_limiter.SetRate(bytes_per_second, burst);
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::UpdateCompletion, shared_from_this()));
+}
+
+void TcpConnection::SetWriteRateLimit(uint64_t bytes_per_second, uint64_t burst)
+{
+    m_write_limiter.SetRate(bytes_per_second, burst);
+}
+
+bool TcpConnection::WriteLimited() const
+{
+    return m_write_limiter.Limited() ||
+           (m_shared_write_limiter && m_shared_write_limiter->Limited());
+}
+
+// the read bucket is empty, stop reading until it refills
+void TcpConnection::ThrottleRead(int64_t now)
+{
+    if (m_read_paused & kPausedByRateLimit) return;
+
+    SetReadPaused(kPausedByRateLimit, true);
+
+    int64_t delay = Delay(&m_read_limiter, m_shared_read_limiter.get(), now);
+    m_owner_loop->RunAfter(static_cast<double>(delay) / Timestamp::kMicroSecondsPerSecond,
+                           std::bind(&TcpConnection::ResumeThrottledRead, shared_from_this()));
+}
+
+void TcpConnection::ResumeThrottledRead()
+{
+    int64_t now = m_owner_loop->Now().MicroSecondsSinceEpoch();
+
+    // a shared bucket may have been drained again by other connections
+    SetReadPaused(kPausedByRateLimit, false);
+    if (Allowance(&m_read_limiter, m_shared_read_limiter.get(), now) == 0) {
+        ThrottleRead(now);
+    }
+}
+
+// the write bucket is empty with output pending, stop waiting for
+// writability until it refills
+void TcpConnection::ThrottleWrite(int64_t now)
+{
+    if (m_write_throttled) return;
+
+    m_write_throttled = true;
+    m_channel.EnableWrite(false);
+
+    int64_t delay = Delay(&m_write_limiter, m_shared_write_limiter.get(), now);
+    m_owner_loop->RunAfter(static_cast<double>(delay) / Timestamp::kMicroSecondsPerSecond,
+                           std::bind(&TcpConnection::ResumeThrottledWrite, shared_from_this()));
+}
+
+void TcpConnection::ResumeThrottledWrite()
+{
+    m_write_throttled = false;
+
+    if (m_state == kDisconnected || m_channel.WriteEnable() ||
+        m_output_buffer.ReadableBytes() == 0) {
+        return;
+    }
+
+    m_channel.EnableWrite(true);
+    HandleWrite();
+}
+
+// after output was queued
+void TcpConnection::CheckHighWaterMark()
+{
+    size_t queued = m_output_buffer.ReadableBytes();
+    if (m_high_water_mark == 0 || m_above_high_water || queued < m_high_water_mark) return;
+
+    m_above_high_water = true;
+    if (m_pause_on_high_water) SetReadPaused(kPausedByHighWater, true);
+
+    // not from inside the SendMessage that crossed the mark
+    if (m_high_water_mark_event_handler) {
+        m_owner_loop->QueueInLoop(std::bind(m_high_water_mark_event_handler,
+                                            shared_from_this(), queued));
+    }
+}
+
+// after output was written
+void TcpConnection::CheckLowWaterMark()
+{
+    if (m_above_high_water == false ||
+        m_output_buffer.ReadableBytes() > m_low_water_mark) {
+        return;
+    }
+
+    m_above_high_water = false;
+    if (m_pause_on_high_water) SetReadPaused(kPausedByHighWater, false);
+
+    if (m_low_water_mark_event_handler) {
+        m_low_water_mark_event_handler(shared_from_this());
+    }
+}
+
+void TcpConnection::SetIdleTimeout(double seconds)
+{
+    SetTimeout(&m_idle_timeout, seconds);
+}
+
+void TcpConnection::SetReadTimeout(double seconds)
+{
+    SetTimeout(&m_read_timeout, seconds);
+}
+
+void TcpConnection::SetWriteTimeout(double seconds)
+{
+    SetTimeout(&m_write_timeout, seconds);
+}
+
+void TcpConnection::SetBufferReclaim(double grace_seconds)
+{
+    SetTimeout(&m_reclaim_grace, grace_seconds);
+}
+
+void TcpConnection::SetTimeout(int64_t* timeout, double seconds)
+{
+    int64_t value = static_cast<int64_t>(seconds * Timestamp::kMicroSecondsPerSecond);
+
+    TcpConnectionPtr guard_this(shared_from_this());
+
+    m_owner_loop->RunInLoop([guard_this, this, timeout, value] {
+        *timeout = value;
+        ScheduleTimeout();
+    });
+}
+
+void TcpConnection::ScheduleTimeout()
+{
+    if (m_timeout_scheduled || m_state != kConnected) return;
+
+    int64_t deadline = NextTimeout();
+    if (deadline < 0) return;
+
+    m_timeout_scheduled = true;
+    m_owner_loop->Timeouts()->Add(shared_from_this(), deadline);
+}
+
+// earliest deadline of the enabled timeouts, -1 when none applies
+int64_t TcpConnection::NextTimeout() const
+{
+    int64_t deadline = INT64_MAX;
+
+    if (m_idle_timeout > 0) {
+        deadline = std::min(deadline, std::max(m_last_read, m_last_write) + m_idle_timeout);
+    }
+
+    if (m_read_timeout > 0 && m_read_paused == 0) {
+        deadline = std::min(deadline, m_last_read + m_read_timeout);
+    }
+
+    if (m_write_timeout > 0 && m_output_buffer.ReadableBytes() > 0) {
+        deadline = std::min(deadline, m_last_write + m_write_timeout);
+    }
+
+    int64_t reclaim = ReclaimDeadline();
+    if (reclaim >= 0) {
+        deadline = std::min(deadline, reclaim);
+    }
+
+    return deadline == INT64_MAX ? -1 : deadline;
+}
+
+// when the input buffer storage is due back to the pool, -1 if it is not held
+// or reclaim is immediate or off
+int64_t TcpConnection::ReclaimDeadline() const
+{
+    if (m_reclaim_grace <= 0 || m_input_buffer.Capacity() == 0 ||
+        m_input_buffer.ReadableBytes() > 0) {
+        return -1;
+    }
+
+    return std::max(m_last_read, m_last_write) + m_reclaim_grace;
+}
+
+// called by the TimeoutWheel when the bucket holding this connection is due,
+// returns the deadline to check again or -1 to leave the wheel
+int64_t TcpConnection::CheckTimeout(int64_t now)
+{
+    m_timeout_scheduled = false;
+    if (m_state != kConnected) return -1;
+
+    int64_t reclaim = ReclaimDeadline();
+    if (reclaim >= 0 && reclaim <= now) {
+        m_input_buffer.Release();
+    }
+
+    int64_t deadline = NextTimeout();
+    if (deadline < 0 || deadline > now) {
+        m_timeout_scheduled = deadline >= 0;
+        return deadline;
+    }
+
+    TimeoutType type = kIdleTimeout;
+    if (m_read_timeout > 0 && m_read_paused == 0 && m_last_read + m_read_timeout <= now) {
+        type = kReadTimeout;
+    } else if (m_write_timeout > 0 && m_output_buffer.ReadableBytes() > 0 &&
+               m_last_write + m_write_timeout <= now) {
+        type = kWriteTimeout;
+    }
+
+    LOG(DEBUG) << "TcpConnection " << m_id << " timeout " << type;
+
+    if (m_timeout_event_handler == NULL) {
+        Close();
+        return -1;
+    }
+
+    m_timeout_event_handler(shared_from_this(), type);
+    if (m_state != kConnected) return -1;
+
+    m_last_read = m_last_write = now;
+    ScheduleTimeout();
+
+    return -1;
+}
+
 void TcpConnection::Shutdown()
 {
     StateE expected = kConnected;
@@ -66,7 +461,9 @@ void TcpConnection::ConnectDestroyed()
     StateE expected = kConnected;
 
     if (m_state.compare_exchange_strong(expected, kDisconnected)) {
-        m_channel->EnableReadWrite(false, false);
+        m_channel.EnableReadWrite(false, false);
+        m_channel.Remove();
+
         if (m_state_change_event_handler) {
             m_state_change_event_handler(shared_from_this());
         }
@@ -82,7 +479,16 @@ void TcpConnection::ConnectEstablished()
         if (m_state.compare_exchange_strong(expected, kConnected)) {
             assert(m_state == kConnected);
 
-            m_channel->EnableRead(true);
+            // handlers may close the connection while both sides of one event run
+            m_channel.Tie(shared_from_this());
+
+            if (m_edge_triggered) m_channel.EnableEdgeTriggered(true);
+
+            UpdateCompletion();
+            m_channel.EnableRead(m_read_paused == 0);
+
+            m_last_read = m_last_write = m_owner_loop->Now().MicroSecondsSinceEpoch();
+            ScheduleTimeout();
 
             if (m_state_change_event_handler) {
                 m_state_change_event_handler(shared_from_this());
@@ -104,11 +510,156 @@ void TcpConnection::SendMessage(const std::string& message)
 
 void TcpConnection::SendMessage(const void* message, size_t msg_len)
 {
-    if (m_state == kConnected) {
-        m_owner_loop->RunInLoop(std::bind(&TcpConnection::SendBase, this, message, msg_len));
+    if (m_state != kConnected) return;
+
+    if (m_owner_loop->IsInLoopThread()) {
+        SendBase(message, msg_len);
+    } else {
+        // the caller's memory may be gone by the time the task runs
+        SendMessage(std::string(static_cast<const char*>(message), msg_len));
+    }
+}
+
+void TcpConnection::SendMessage(std::string&& message)
+{
+    if (CopyCheaper(message.size())) {
+        SendBase(message.data(), message.size());
+    } else {
+        SendMessage(Slice(std::move(message)));
+    }
+}
+
+void TcpConnection::SendMessage(Buffer&& message)
+{
+    if (CopyCheaper(message.ReadableBytes())) {
+        SendBase(message.Peek(), message.ReadableBytes());
+    } else {
+        SendMessage(Slice(std::move(message)));
+    }
+}
+
+// unless zerocopy wants the payload whole
+bool TcpConnection::CopyCheaper(size_t bytes) const
+{
+    size_t zerocopy = m_output_buffer.ZeroCopyThreshold();
+
+    return m_state == kConnected && bytes < kSliceMinBytes &&
+           (zerocopy == 0 || bytes < zerocopy) && m_owner_loop->IsInLoopThread();
+}
+
+void TcpConnection::SendMessage(const Slice& message)
+{
+    if (m_state != kConnected || message.Empty()) return;
+
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::SendSliceInLoop, shared_from_this(),
+                                      message));
+}
+
+void TcpConnection::SendFile(int fd, off_t offset, size_t length)
+{
+    if (m_state != kConnected) return;
+
+    int dup_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1) {
+        LOG(ERROR) << "TcpConnection [" << Name() << "] SendFile dup error " << errno
+                   << " (" << ::strerror(errno) << ')';
+        return;
+    }
+
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::SendFileInLoop, shared_from_this(),
+                                      dup_fd, offset, length));
+}
+
+void TcpConnection::SendFileInLoop(int fd, off_t offset, size_t length)
+{
+    if (m_state == kDisconnected) {
+        LOG(WARN) << "connection [" << Name() << "] disconnected, give up sending file";
+        ::close(fd);
+        return;
+    }
+
+    m_output_buffer.AppendFile(fd, offset, length);
+    CheckHighWaterMark();
+    StartWriting();
+}
+
+void TcpConnection::SendSliceInLoop(const Slice& message)
+{
+    if (m_state == kDisconnected) {
+        LOG(WARN) << "connection [" << Name() << "] disconnected, give up writing";
+        return;
+    }
+
+    m_output_buffer.AppendExternal(message.Data(), message.Size(), message.Owner());
+    CheckHighWaterMark();
+    StartWriting();
+}
+
+// output was queued directly, start sending right away if nothing was
+// pending, or at the end of the iteration when coalescing
+void TcpConnection::StartWriting()
+{
+    if (m_channel.WriteEnable() || m_write_throttled) return;
+
+    if (m_coalesce_writes == false) {
+        Flush();
+    } else if (m_flush_scheduled == false) {
+        m_flush_scheduled = true;
+        m_owner_loop->RunAtIterationEnd(std::bind(&TcpConnection::Flush, shared_from_this()));
     }
 }
 
+void TcpConnection::Flush()
+{
+    m_flush_scheduled = false;
+
+    if (m_state == kDisconnected || m_channel.WriteEnable() || m_write_throttled ||
+        m_output_buffer.ReadableBytes() == 0) {
+        return;
+    }
+
+    m_last_write = m_owner_loop->Now().MicroSecondsSinceEpoch();
+    if (m_write_timeout > 0) ScheduleTimeout();
+
+    m_channel.EnableWrite(true);
+    HandleWrite();
+}
+
+void TcpConnection::SetZeroCopyThreshold(size_t bytes)
+{
+    m_owner_loop->RunInLoop(std::bind(&TcpConnection::SetZeroCopyInLoop,
+                                      shared_from_this(), bytes));
+}
+
+void TcpConnection::SetZeroCopyInLoop(size_t bytes)
+{
+    if (bytes > 0 && m_output_buffer.ZeroCopyThreshold() == 0) {
+        int on = 1;
+        if (::setsockopt(m_sock.GetFd(), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1) {
+            LOG(WARN) << "TcpConnection [" << Name() << "] SO_ZEROCOPY error " << errno
+                      << " (" << ::strerror(errno) << "), zerocopy stays off";
+            return;
+        }
+    }
+
+    m_output_buffer.SetZeroCopyThreshold(bytes);
+    UpdateCompletion();
+}
+
+// a recv op can neither stop at the read allowance nor watch the error queue
+// zerocopy completions wait on, connections with a limit or zerocopy read for
+// themselves. a limit shared with the server is seen on the next read
+void TcpConnection::UpdateCompletion()
+{
+    bool limited = m_read_limiter.Limited() ||
+                   (m_shared_read_limiter && m_shared_read_limiter->Limited());
+
+    CompletionOp op = kCompletionRecv;
+    if (limited || m_output_buffer.ZeroCopyThreshold() > 0) op = kCompletionNone;
+
+    if (m_channel.GetCompletion() != op) m_channel.SetCompletion(op);
+}
+
 void TcpConnection::SendBase(const void* messgae, size_t msg_len)
 {
     ssize_t nwtote = 0;
@@ -116,13 +667,16 @@ void TcpConnection::SendBase(const void* messgae, size_t msg_len)
     bool fault_error = false;
 
     if (m_state == kDisconnected) {
-        LOG(WARN) << "connection [" << m_name << "] disconnected, give up writing" ;
+        LOG(WARN) << "connection [" << Name() << "] disconnected, give up writing" ;
         return;
     }
 
-    if (m_channel->WriteEnable() == false && m_output_buffer.ReadableBytes() == 0) {
-        nwtote = ::write(m_sock->GetFd(), messgae, msg_len);
+    // a coalesced or rate limited connection always goes through the queue
+    if (m_coalesce_writes == false && WriteLimited() == false &&
+        m_channel.WriteEnable() == false && m_output_buffer.ReadableBytes() == 0) {
+        nwtote = ::write(m_sock.GetFd(), messgae, msg_len);
         if (nwtote >= 0) {
+            m_last_write = m_owner_loop->Now().MicroSecondsSinceEpoch();
             remaining = msg_len - nwtote;
             if (remaining == 0) {
                 if (m_write_complete_event_handler) {
@@ -140,8 +694,16 @@ void TcpConnection::SendBase(const void* messgae, size_t msg_len)
     assert(remaining < 0 || static_cast<size_t>(remaining) <= msg_len);
     if (fault_error == false && remaining > 0) {
         m_output_buffer.Append(static_cast<const char*>(messgae) + nwtote, remaining);
-        if (m_channel->WriteEnable() == false) {
-            m_channel->EnableWrite(true);
+        CheckHighWaterMark();
+
+        if (m_coalesce_writes || WriteLimited()) {
+            StartWriting();
+        } else if (m_channel.WriteEnable() == false && m_write_throttled == false) {
+            m_channel.EnableWrite(true);
+            
+            // the write timeout counts from when output starts waiting
+            m_last_write = m_owner_loop->Now().MicroSecondsSinceEpoch();
+            if (m_write_timeout > 0) ScheduleTimeout();
         }
     }
 }
@@ -151,38 +713,80 @@ void TcpConnection::HandlerClose()
     assert(m_state == kConnected || m_state == kDisconnecting);
     m_state = kDisconnected;
 
-    m_channel->EnableReadWrite(false, false);
+    // the last reference may be dropped on any thread, the poller is left here
+    m_channel.EnableReadWrite(false, false);
+    m_channel.Remove();
+
     TcpConnectionPtr guard_this(shared_from_this());
 
     if (m_state_change_event_handler) {
         m_state_change_event_handler(guard_this);
     }
 
-    m_owner_loop->RunInLoop(std::bind(m_close_event_handler, guard_this));
+    // already in the loop thread, binding it into a task would allocate
+    if (m_close_event_handler) {
+        m_close_event_handler(guard_this);
+    }
 }
 
+// with output still queued HandleWrite shuts down once it drains. write
+// interest alone does not tell, coalesced and throttled output waits with
+// it off
 void TcpConnection::HandlerShutdown()
 {
-    if (m_channel->ReadEnable() == false) {
-        m_sock->ShutdownWrite();
+    if (m_output_buffer.ReadableBytes() == 0) {
+        m_sock.ShutdownWrite();
     }
 }
 
 void TcpConnection::HandleRead(Timestamp receiveTime)
-{       
+{
+    if (m_channel.ReadEnable() == false) return;
+
+    UpdateCompletion();
+
+    // the poller received already, see Channel::SetCompletion
+    if (m_channel.Completing() || m_channel.Completions().empty() == false) {
+        HandleReceived(receiveTime);
+        return;
+    }
+
+    int64_t now = m_owner_loop->Now().MicroSecondsSinceEpoch();
+
+    uint64_t allowance = Allowance(&m_read_limiter, m_shared_read_limiter.get(), now);
+    if (allowance == 0) {
+        ThrottleRead(now);
+        return;
+    }
+
     int err_code = 0;
-    ssize_t n = m_input_buffer.ReadFd(m_sock->GetFd() , &err_code);
-    if (n > 0) {
-        if (m_message_event_handler) {
-            m_message_event_handler(shared_from_this(), &m_input_buffer, receiveTime);
+    ssize_t n = 0;
+    size_t nread = 0;
+    size_t budget = std::min<uint64_t>(m_read_budget, allowance);
+
+    do {
+        n = m_input_buffer.ReadFd(m_sock.GetFd(), &err_code, m_owner_loop->GetReadScratch(),
+                                  allowance - nread);
+        if (n > 0) nread += n;
+    } while (m_edge_triggered && nread < budget &&
+             (n > 0 || (n == -1 && err_code == EINTR)));
+
+    // the handler closed it, an EOF read along with the data is moot
+    if (nread > 0 && Received(nread, allowance, now, receiveTime) == false) return;
+
+    if (n > 0 || (n == -1 && err_code == EINTR)) {
+        // read budget used up, there may be more data the edge will not report again
+        if (m_edge_triggered) {
+            m_owner_loop->QueueInLoop(std::bind(&TcpConnection::HandleRead,
+                                                shared_from_this(), receiveTime));
         }
     } else if(n == 0) {
         HandlerClose();
-    } else if (err_code != EAGAIN && err_code != EINTR) {
+    } else if (err_code != EAGAIN) {
         socklen_t len = sizeof(err_code);
 
-        ::getsockopt(m_sock->GetFd(), SOL_SOCKET, SO_ERROR, &err_code, &len);
-        LOG(WARN) << "TcpConnection [" << m_name << "] SO_ERROR = " << err_code 
+        ::getsockopt(m_sock.GetFd(), SOL_SOCKET, SO_ERROR, &err_code, &len);
+        LOG(WARN) << "TcpConnection [" << Name() << "] SO_ERROR = " << err_code 
                   << " (" << ::strerror(err_code) << ')';
         
         if (m_error_event_handler) {
@@ -191,28 +795,152 @@ void TcpConnection::HandleRead(Timestamp receiveTime)
     }
 }
 
+// byte counts, 0 at EOF and -errno, of the receives the poller made. they
+// took no heed of the allowance, reading pauses until the debt is paid
+void TcpConnection::HandleReceived(Timestamp receiveTime)
+{
+    int64_t now = m_owner_loop->Now().MicroSecondsSinceEpoch();
+
+    Channel::CompletionList& results = m_channel.Completions();
+
+    size_t nread = 0;
+    int err_code = 0;
+    bool eof = false;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i] > 0) {
+            nread += results[i];
+        } else if (results[i] == 0) {
+            eof = true;
+        } else {
+            err_code = -results[i];
+        }
+    }
+
+    results.clear();
+
+    uint64_t allowance = Allowance(&m_read_limiter, m_shared_read_limiter.get(), now);
+    if (nread > 0 && Received(nread, allowance, now, receiveTime) == false) return;
+
+    if (err_code != 0) {
+        LOG(WARN) << "TcpConnection [" << Name() << "] recv error = " << err_code
+                  << " (" << ::strerror(err_code) << ')';
+
+        if (m_error_event_handler) {
+            m_error_event_handler(shared_from_this(), err_code);
+        }
+    }
+
+    if (eof && m_state != kDisconnected) HandlerClose();
+}
+
+// nread bytes are in the input buffer, false once the message handler closed
+// the connection
+bool TcpConnection::Received(size_t nread, uint64_t allowance, int64_t now, Timestamp receiveTime)
+{
+    m_last_read = now;
+
+    // reads stop at the allowance, a bucket shared across loops may still be
+    // overdrawn meanwhile, the pause then lasts until the debt is paid
+    Consume(&m_read_limiter, m_shared_read_limiter.get(), nread, now);
+    if (nread >= allowance) ThrottleRead(now);
+
+    if (m_message_event_handler) {
+        m_message_event_handler(shared_from_this(), &m_input_buffer, receiveTime);
+    }
+
+    if (m_state == kDisconnected) return false;
+
+    if (m_input_buffer.ReadableBytes() == 0) {
+        if (m_reclaim_grace == 0) {
+            m_input_buffer.Release();
+        } else if (m_reclaim_grace > 0) {
+            ScheduleTimeout();
+        }
+    }
+
+    return true;
+}
+
+// EPOLLERR: zerocopy completions wait on the error queue, anything else is
+// a pending socket error
+void TcpConnection::HandleError()
+{
+    if (m_output_buffer.ReapZeroCopy(m_sock.GetFd())) return;
+
+    int err_code = 0;
+    socklen_t len = sizeof(err_code);
+
+    ::getsockopt(m_sock.GetFd(), SOL_SOCKET, SO_ERROR, &err_code, &len);
+    if (err_code == 0) return;
+
+    LOG(WARN) << "TcpConnection [" << Name() << "] SO_ERROR = " << err_code
+              << " (" << ::strerror(err_code) << ')';
+
+    if (m_error_event_handler) {
+        m_error_event_handler(shared_from_this(), err_code);
+    }
+}
+
 void TcpConnection::HandleWrite()
 {
-    if (m_channel->WriteEnable()) {
-        ssize_t nwtote = ::write(m_sock->GetFd(), m_output_buffer.Peek(), 
-                                 m_output_buffer.ReadableBytes());
+    if (m_channel.WriteEnable()) {
+        int64_t now = m_owner_loop->Now().MicroSecondsSinceEpoch();
 
-        if (nwtote > 0) {
-            m_output_buffer.Retrieve(nwtote);
-            if (m_output_buffer.ReadableBytes() == 0) {
-                m_channel->EnableWrite(false);
+        uint64_t allowance = Allowance(&m_write_limiter, m_shared_write_limiter.get(), now);
+        if (allowance == 0) {
+            ThrottleWrite(now);
+            return;
+        }
 
-                if (m_write_complete_event_handler) {
-                    m_write_complete_event_handler(shared_from_this());
-                }
+        ssize_t nwtote = 0;
+        uint64_t written = 0;
+        int err_code = 0;
+
+        do {
+            nwtote = m_output_buffer.WriteFd(m_sock.GetFd(), &err_code, allowance - written);
+            if (nwtote > 0) written += nwtote;
+        } while (m_edge_triggered && m_output_buffer.ReadableBytes() > 0 && written < allowance &&
+                 (nwtote > 0 || (nwtote == -1 && err_code == EINTR)));
+
+        if (written > 0) {
+            m_last_write = now;
+            Consume(&m_write_limiter, m_shared_write_limiter.get(), written, now);
+
+            CheckLowWaterMark();
+        }
+
+        // EIO: a queued file range was cut short and dropped, the rest of the
+        // queue still goes out
+        if (nwtote == -1 && err_code != EAGAIN && err_code != EINTR) {
+            LOG(ERROR) << "TcpConnection::HandleWrite error " << err_code << " ("
+                       << ::strerror(err_code) << ')';
 
-                if (m_state == kDisconnecting) Shutdown();
+            if (m_error_event_handler) {
+                m_error_event_handler(shared_from_this(), err_code);
             }
-        } else {
-            LOG(ERROR) << "TcpConnection::HandleWrite error " << errno << " ("
-                       << ::strerror(errno) << ')';
+
+            if (m_state == kDisconnected) return;
+
+            // the edge will not report writability again for what is left
+            if (m_edge_triggered && m_output_buffer.ReadableBytes() > 0) {
+                m_owner_loop->QueueInLoop(std::bind(&TcpConnection::HandleWrite, shared_from_this()));
+            }
+        }
+
+        // a dropped segment may have emptied the queue without a byte written
+        if (m_output_buffer.ReadableBytes() == 0) {
+            m_channel.EnableWrite(false);
+
+            if (m_write_complete_event_handler) {
+                m_write_complete_event_handler(shared_from_this());
+            }
+
+            if (m_state == kDisconnecting) HandlerShutdown();
+        } else if (written >= allowance) {
+            ThrottleWrite(now);
         }
     } else {
-        LOG(TRACE) << "connection fd " << m_sock->GetFd() << " is down, no more writing";
+        LOG(TRACE) << "connection fd " << m_sock.GetFd() << " is down, no more writing";
     }
 }
\ No newline at end of file
@@ -2,18 +2,26 @@
 
 #include "any.h"
 #include "Buffer.h"
+#include "Slice.h"
+#include "Socket.h"
+#include "Channel.h"
 #include "Callbacks.h"
+#include "ChainBuffer.h"
 #include "InetAddress.h"
 #include "noncopyable.h"
+#include "RateLimiter.h"
 
+#include <mutex>
 #include <atomic>
 #include <memory>
+#include <string>
+
+#include <stdint.h>
 
 namespace buzz
 {
-    class Socket;
-    class Channel;
     class EventLoop;
+    class TimeoutWheel;
 
     class TcpConnection 
         : noncopyable , public std::enable_shared_from_this<TcpConnection>
@@ -21,7 +29,14 @@ namespace buzz
     public:
         enum StateE { kDisconnected, kConnecting, kConnected, kDisconnecting };
 
-        TcpConnection(EventLoop* loop, const std::string& name, int clnt_fd, 
+        static const size_t kDefaultReadBudget = 256 * 1024;
+
+        // owned payloads below this, sent from the loop thread, are copied
+        static const size_t kSliceMinBytes = 16 * 1024;
+
+        // the name is the prefix and the id joined by '@', built on first use
+        TcpConnection(EventLoop* loop, uint64_t id,
+                      const std::shared_ptr<const std::string>& name_prefix, int clnt_fd,
                       const InetAddress& local_addr,
                       const InetAddress& peer_addr);
 
@@ -30,7 +45,9 @@ namespace buzz
         StateE GetState() { return m_state; }
         EventLoop* OwnerLoop() { return m_owner_loop; }
 
-        const std::string Name() const { return m_name; }
+        uint64_t Id() const { return m_id; }
+
+        const std::string& Name() const;
 
         void OnError(const ErrorEventHandler&& handler)
         {
@@ -57,25 +74,137 @@ namespace buzz
             m_write_complete_event_handler = handler;
         }
         
+        // opt-in EPOLLET: reads drain until EAGAIN or read_budget bytes per
+        // event, writes continue until the output buffer is empty or EAGAIN.
+        // must be called before ConnectEstablished
+        void SetEdgeTriggered(bool on, size_t read_budget = kDefaultReadBudget)
+        {
+            m_edge_triggered = on;
+            m_read_budget = read_budget;
+        }
+
+        // sends only queue output, the connections written to in a loop
+        // iteration are flushed once with writev before the next Poll. a
+        // handler sending a header, a body and a trailer then costs one
+        // syscall and no small segments, at the price of holding the
+        // output until the iteration ends. call before ConnectEstablished
+        // or in the loop thread
+        void SetWriteCoalescing(bool on) { m_coalesce_writes = on; }
+
+        void SetTcpNoDelay(bool on);
+
+        void OnHighWaterMark(const HighWaterMarkEventHandler&& handler)
+        {
+            m_high_water_mark_event_handler = handler;
+        }
+
+        void OnLowWaterMark(const LowWaterMarkEventHandler&& handler)
+        {
+            m_low_water_mark_event_handler = handler;
+        }
+
+        // OnHighWaterMark fires with the queued size when queued output (file
+        // ranges included) reaches high bytes, OnLowWaterMark once it drains
+        // back to low. 0 turns the marks off. with pause_reading the
+        // connection also stops reading from the peer in between, so a
+        // request/response server stops taking requests it cannot answer.
+        // a proxy pauses the other side from these handlers instead. call
+        // before ConnectEstablished or in the loop thread
+        void SetHighWaterMark(size_t high, size_t low, bool pause_reading = false);
+
+        // bytes per second read from and written to this connection, 0 lifts
+        // the limit. burst is how much may pass at once after a quiet period,
+        // one second worth when 0. reading pauses and writing waits while the
+        // bucket is empty, a timer on the loop resumes them. any thread, any time
+        void SetReadRateLimit(uint64_t bytes_per_second, uint64_t burst = 0);
+        void SetWriteRateLimit(uint64_t bytes_per_second, uint64_t burst = 0);
+
+        // buckets shared with other connections, a server wide limit, checked
+        // in addition to the connection's own. call before ConnectEstablished
+        void ShareRateLimiters(const std::shared_ptr<RateLimiter>& read,
+                               const std::shared_ptr<RateLimiter>& write)
+        {
+            m_shared_read_limiter = read;
+            m_shared_write_limiter = write;
+        }
+
+        // stop and restart reading from the peer, e.g. while the other side
+        // of a proxy is above its high water mark. independent of the pause
+        // caused by the high water mark, reading resumes once neither holds
+        void PauseReading();
+        void ResumeReading();
+
+        void OnTimeout(const TimeoutEventHandler&& handler)
+        {
+            m_timeout_event_handler = handler;
+        }
+
+        // timeouts in seconds, 0 turns one off. idle counts from the last read
+        // or write, read from the last received data, write from the last
+        // progress while output is pending. an expired timeout closes the
+        // connection, or calls the OnTimeout handler instead and restarts the
+        // timeouts if the handler leaves the connection open. checked on the
+        // loop's one second TimeoutWheel, so they fire up to two seconds late
+        void SetIdleTimeout(double seconds);
+        void SetReadTimeout(double seconds);
+        void SetWriteTimeout(double seconds);
+
+        // storage of an empty input buffer goes back to the loop's ChunkPool
+        // once grace seconds pass without traffic, right after the message
+        // handler drains it with 0 (the default), never when negative. the
+        // output queue returns its chunks as soon as they are written
+        void SetBufferReclaim(double grace_seconds);
+
         void Close(double seconds = 0.0);
         void Shutdown();
         
         void ConnectDestroyed();
         void ConnectEstablished();
 
+        // these copy the bytes, off the loop thread before returning
         void SendMessage(Buffer* message);
         void SendMessage(const std::string& message);
         void SendMessage(const void *message, size_t msg_len);
+
+        // these take the bytes over, they reach writev without being copied
+        // from any thread. below kSliceMinBytes in the loop thread they are
+        // written or copied like the above, cheaper than a refcount and a task
+        void SendMessage(std::string&& message);
+        void SendMessage(Buffer&& message);
+        void SendMessage(const Slice& message);
+
+        // queues length bytes of fd from offset behind the data already sent
+        // and transmits them with sendfile as the socket becomes writable.
+        // fd is duplicated, the caller keeps its own descriptor and file
+        // position. OnWriteComplete fires once the whole range has gone out
+        void SendFile(int fd, off_t offset, size_t length);
+
+        // sends slices of at least bytes with MSG_ZEROCOPY, 0 turns it
+        // off. pinning pages and reaping completions costs more than copying
+        // small payloads, so only worth it for large ones. stays off when the
+        // kernel lacks SO_ZEROCOPY
+        void SetZeroCopyThreshold(size_t bytes);
+
+        // zerocopy sends whose payload the kernel may still read, their owners
+        // are held until it reports them done, past the connection's end if
+        // need be. loop thread only
+        size_t ZeroCopyPending() const { return m_output_buffer.ZeroCopyPending(); }
         
         void SetContex(any& contex) { m_contex = contex; }
         const any* GetContex() const { return &m_contex; }
     private:
         EventLoop*  m_owner_loop;
         
-        const std::string        m_name;
-        std::atomic<StateE>      m_state;
-        std::unique_ptr<Socket>  m_sock;
-        std::unique_ptr<Channel> m_channel;
+        const uint64_t                           m_id;
+        const std::shared_ptr<const std::string> m_name_prefix;
+        mutable std::once_flag                   m_name_once;
+        mutable std::string                      m_name;
+
+        std::atomic<StateE> m_state;
+
+        // held by value so a connection is one allocation
+        Socket  m_sock;
+        Channel m_channel;
         
         const InetAddress m_local_addr;
         const InetAddress m_peer_addr;
@@ -85,17 +214,81 @@ namespace buzz
         MessageEventHandler       m_message_event_handler;
         StateChangeEventHandler   m_state_change_event_handler;
         WriteCompleteEventHandler m_write_complete_event_handler;
+        TimeoutEventHandler       m_timeout_event_handler;
+        HighWaterMarkEventHandler m_high_water_mark_event_handler;
+        LowWaterMarkEventHandler  m_low_water_mark_event_handler;
+
+        Buffer      m_input_buffer;
+        ChainBuffer m_output_buffer;
+
+        bool   m_edge_triggered;
+        size_t m_read_budget;
 
-        Buffer m_input_buffer;
-        Buffer m_output_buffer;
+        bool m_coalesce_writes;
+        bool m_flush_scheduled;
+
+        // reasons reading is paused, reads are enabled while none is set
+        enum ReadPause { kPausedByUser = 1, kPausedByHighWater = 2, kPausedByRateLimit = 4 };
+
+        size_t m_high_water_mark;
+        size_t m_low_water_mark;
+        bool   m_pause_on_high_water;
+        bool   m_above_high_water;
+        int    m_read_paused;
+
+        RateLimiter                  m_read_limiter;
+        RateLimiter                  m_write_limiter;
+        std::shared_ptr<RateLimiter> m_shared_read_limiter;
+        std::shared_ptr<RateLimiter> m_shared_write_limiter;
+
+        bool m_write_throttled;
+
+        // microseconds, 0 when off
+        int64_t m_idle_timeout;
+        int64_t m_read_timeout;
+        int64_t m_write_timeout;
+        int64_t m_reclaim_grace;
+
+        int64_t m_last_read;
+        int64_t m_last_write;
+        bool    m_timeout_scheduled;
 
         any m_contex;
 
+        friend class TimeoutWheel;
+
+        void SetTimeout(int64_t* timeout, double seconds);
+        void ScheduleTimeout();
+        int64_t NextTimeout() const;
+        int64_t ReclaimDeadline() const;
+        int64_t CheckTimeout(int64_t now);
+
         void HandlerClose();
         void HandlerShutdown();
         void HandleRead(Timestamp receiveTime);
+        void HandleReceived(Timestamp receiveTime);
+        bool Received(size_t nread, uint64_t allowance, int64_t now, Timestamp receiveTime);
         void HandleWrite();
+        void HandleError();
+
+        void StartWriting();
+        void Flush();
+
+        void CheckHighWaterMark();
+        void CheckLowWaterMark();
+        void SetReadPaused(int reason, bool paused);
+
+        bool WriteLimited() const;
+        void ThrottleRead(int64_t now);
+        void ThrottleWrite(int64_t now);
+        void ResumeThrottledRead();
+        void ResumeThrottledWrite();
 
-        void SendBase(const void* messgae, size_t msg_len);        
+        void SendBase(const void* messgae, size_t msg_len);
+        void SendSliceInLoop(const Slice& message);
+        bool CopyCheaper(size_t bytes) const;
+        void SendFileInLoop(int fd, off_t offset, size_t length);
+        void SetZeroCopyInLoop(size_t bytes);
+        void UpdateCompletion();
     };
 }
\ No newline at end of file
@@ -3,30 +3,54 @@
 #include "TcpServer.h"
 #include "EventLoop.h"
 #include "TcpConnection.h"
+#include "PoolAllocator.h"
 
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/socket.h>
 
 using namespace buzz;
 
+const size_t TcpServer::kDefaultAcceptBatch;
+
+TcpServer::Listener::Listener()
+    : m_reserve_fd(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+{ }
+
+TcpServer::Listener::~Listener()
+{
+    if (m_reserve_fd != -1) ::close(m_reserve_fd);
+}
+
 TcpServer::TcpServer(EventLoop* loop, const std::string& server_name, InetAddress& local_addr, 
-                     bool reuse_addr)
-    : m_sock(CreateNonBlockSocket()),
-    m_owner_loop(loop),
+                     bool reuse_addr, AcceptMode accept_mode)
+    : m_owner_loop(loop),
     m_local_addr(local_addr),
     m_server_name(server_name),
     m_ip_port(local_addr.ToString()),
+    m_name_prefix(std::make_shared<const std::string>(server_name + ' ' + m_ip_port)),
     m_id(0),
-    m_channel(new Channel(loop, m_sock.GetFd(), kReadEvent)),
-    m_event_loop_poll(m_owner_loop)
+    m_reuse_addr(reuse_addr),
+    m_accept_mode(accept_mode),
+    m_accept_batch(kDefaultAcceptBatch),
+    m_event_loop_poll(m_owner_loop),
+    m_edge_triggered(false),
+    m_read_budget(TcpConnection::kDefaultReadBudget),
+    m_coalesce_writes(false),
+    m_high_water_mark(0),
+    m_low_water_mark(0),
+    m_pause_on_high_water(false),
+    m_read_limiter(std::make_shared<RateLimiter>()),
+    m_write_limiter(std::make_shared<RateLimiter>())
 {
-    m_sock.ReuseAddr(reuse_addr);
-
-    m_sock.Bind(m_local_addr);
-    m_sock.Listen();
+    m_sock = OpenListener();
 
-    m_channel->OnRead(std::bind(&TcpServer::NewConnection, this));
+    // the other modes watch the socket from the IO loops once they are started
+    if (m_accept_mode == kAcceptSingle) {
+        AddListener(m_sock, m_owner_loop);
+    }
 }
 
 TcpServer::~TcpServer() 
@@ -35,54 +59,220 @@ TcpServer::~TcpServer()
 
     LOG(TRACE) << "TcpServer::~TcpServer [" << m_server_name << "] destructing";
 
-    for (auto it : m_connections) {
-        TcpConnectionPtr conn = it.second;
+    std::vector<std::shared_ptr<Listener>> listeners;
+    std::vector<TcpConnectionPtr>          connections;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        listeners.swap(m_listeners);
+        connections.swap(m_connections);
+        m_free_slots.clear();
+    }
+
+    // a channel leaves its poller in its own loop, the socket closes after the last one
+    for (auto listener : listeners) {
+        listener->m_channel->GetOwnerLoop()->RunInLoop([listener] {
+            // accepted by the poller but not handed out yet
+            for (int fd : listener->m_channel->Completions()) {
+                if (fd >= 0) ::close(fd);
+            }
+
+            listener->m_channel.reset();
+        });
+    }
 
-        it.second.reset();
+    for (auto& slot : connections) {
+        if (!slot) continue;
+
+        TcpConnectionPtr conn = slot;
+
+        slot.reset();
         conn->OwnerLoop()->RunInLoop(std::bind(&TcpConnection::ConnectDestroyed, conn));
         
         conn.reset();
     }
 }
 
-void TcpServer::NewConnection()
+void TcpServer::Start(size_t poll_size, EventLoopThreadPoll::SelectPolicy policy)
+{
+    m_event_loop_poll.Start(poll_size, policy);
+    if (m_accept_mode == kAcceptSingle) return;
+
+    std::vector<EventLoop*> loops = m_event_loop_poll.GetAll();
+
+    for (size_t i = 0; i < loops.size(); i++) {
+        // the constructor's socket serves the first loop, the others join its
+        // reuseport group so nothing already queued on it is lost
+        std::shared_ptr<Socket> sock = m_sock;
+        if (m_accept_mode == kAcceptReusePort && i > 0) {
+            sock = OpenListener();
+        }
+
+        loops[i]->RunInLoop(std::bind(&TcpServer::AddListener, this, sock, loops[i]));
+    }
+}
+
+std::shared_ptr<Socket> TcpServer::OpenListener()
+{
+    std::shared_ptr<Socket> sock = std::make_shared<Socket>(CreateNonBlockSocket());
+
+    sock->ReuseAddr(m_reuse_addr);
+    if (m_accept_mode == kAcceptReusePort) sock->ReusePort(true);
+
+    sock->Bind(m_local_addr);
+    sock->Listen();
+
+    return sock;
+}
+
+// in the loop thread of loop
+void TcpServer::AddListener(const std::shared_ptr<Socket>& sock, EventLoop* loop)
 {
-    InetAddress peer_addr;
+    int events = kReadEvent;
+    if (m_accept_mode == kAcceptExclusive) events |= kExclusive;
+
+    std::shared_ptr<Listener> listener = std::make_shared<Listener>();
+    listener->m_sock = sock;
+    listener->m_channel.reset(new Channel(loop, sock->GetFd(), events));
+    listener->m_channel->SetCompletion(kCompletionAccept);
+
+    // a single listener hands out connections, the others keep theirs
+    EventLoop* io_loop = m_accept_mode == kAcceptSingle ? NULL : loop;
+    listener->m_channel->OnRead(std::bind(&TcpServer::HandleAccept, this, listener.get(), io_loop));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listeners.push_back(listener);
+}
+
+void TcpServer::HandleAccept(Listener* listener, EventLoop* loop)
+{
+    Channel* channel = listener->m_channel.get();
+
+    // accepted by the poller already, see Channel::SetCompletion
+    Channel::CompletionList& accepted = channel->Completions();
+
+    for (size_t i = 0; i < accepted.size(); i++) {
+        if (accepted[i] >= 0) {
+            struct ::sockaddr_in addr;
+            ::memset(&addr, 0, sizeof(addr));
+
+            socklen_t len = sizeof(addr);
+            ::getpeername(accepted[i], reinterpret_cast<struct sockaddr*>(&addr), &len);
+
+            NewConnection(accepted[i], InetAddress(addr), loop);
+        } else if (accepted[i] == -EMFILE || accepted[i] == -ENFILE) {
+            DropConnection(listener);
+        } else if (accepted[i] != -EINTR && accepted[i] != -ECONNABORTED) {
+            LOG(WARN) << "bad accept " << -accepted[i] << " (" << ::strerror(-accepted[i]) << ')';
+        }
+    }
+
+    accepted.clear();
+
+    if (channel->Completing()) return;
+
+    for (size_t i = 0; i < m_accept_batch; i++) {
+        InetAddress peer_addr;
+
+        int clnt_fd = listener->m_sock->Accept(peer_addr);
+        if (clnt_fd >= 0) {
+            NewConnection(clnt_fd, peer_addr, loop);
+            continue;
+        }
+
+        // drained, or another loop took it
+        if (errno == EAGAIN) break;
+
+        // the peer gave up before it was accepted
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+
+        if (errno == EMFILE || errno == ENFILE) {
+            DropConnection(listener);
+            continue;
+        }
 
-    int clnt_fd = m_sock.Accept(peer_addr);
-    if (clnt_fd < 0 && errno != EAGAIN && errno != EINTR) {
         LOG(WARN) << "bad accept " << errno << " (" << ::strerror(errno) << ')';
-        return;
+        break;
     }
+}
 
-    char buf[128];
-    snprintf(buf, sizeof(buf), " %s@%" PRIu64, m_ip_port.c_str(), m_id++);
+// out of fds: free the reserve fd, accept the connection into it and close
+// it, so the peer sees the connection refused instead of hanging
+void TcpServer::DropConnection(Listener* listener)
+{
+    LOG(WARN) << "TcpServer [" << m_server_name << "] out of fds, dropping a connection";
 
-    std::ostringstream oss;
-    oss << m_server_name << buf;
-    
-    const std::string& conn_name = oss.str();
-    LOG(INFO) << "new connection [" << conn_name << "] from " << peer_addr.ToString();
-    
-    EventLoop* io_loop = m_event_loop_poll.Get();
+    if (listener->m_reserve_fd != -1) {
+        ::close(listener->m_reserve_fd);
+        listener->m_reserve_fd = -1;
+    }
+
+    int fd = ::accept4(listener->m_sock->GetFd(), NULL, NULL, SOCK_CLOEXEC);
+    if (fd != -1) ::close(fd);
+
+    listener->m_reserve_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void TcpServer::NewConnection(int clnt_fd, const InetAddress& peer_addr, EventLoop* loop)
+{
+    EventLoop* io_loop = loop ? loop : m_event_loop_poll.Get();
+    io_loop->AddConnections(1);
+
+    // the connection and its control block in one block of the loop's pool
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(
+        PoolAllocator<TcpConnection>(io_loop->GetChunkPool()),
+        io_loop, m_id++, m_name_prefix, clnt_fd, m_local_addr, peer_addr);
 
-    TcpConnectionPtr conn(new TcpConnection(io_loop, conn_name, clnt_fd, m_local_addr, peer_addr));
-    m_connections[conn_name] = conn;
+    // the id rather than Name(), which would build the name of every connection
+    LOG(INFO) << "TcpServer [" << m_server_name << "] new connection " << conn->Id()
+              << " from " << peer_addr.ToString();
+
+    size_t slot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_free_slots.empty()) {
+            slot = m_connections.size();
+            m_connections.push_back(conn);
+        } else {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+            m_connections[slot] = conn;
+        }
+    }
     
     conn->OnStateChange(std::move(m_state_change_event_handler));
     conn->OnError(std::move(m_error_event_handler));
     conn->OnMessage(std::move(m_message_event_handler));
     conn->OnWriteComplete(std::move(m_write_complete_event_handler));
-    conn->OnClose(std::bind(&TcpServer::RemoveConnection, this, std::placeholders::_1));
+    conn->OnClose([this, slot] (const TcpConnectionPtr& conn) { RemoveConnection(conn, slot); });
+    conn->SetEdgeTriggered(m_edge_triggered, m_read_budget);
+    conn->SetWriteCoalescing(m_coalesce_writes);
+    conn->SetHighWaterMark(m_high_water_mark, m_low_water_mark, m_pause_on_high_water);
+    conn->OnHighWaterMark(std::move(m_high_water_mark_event_handler));
+    conn->OnLowWaterMark(std::move(m_low_water_mark_event_handler));
+    conn->ShareRateLimiters(m_read_limiter, m_write_limiter);
     
-    io_loop->RunInLoop(std::bind(&TcpConnection::ConnectEstablished, conn));
+    if (io_loop->IsInLoopThread()) {
+        conn->ConnectEstablished();
+    } else {
+        io_loop->QueueInLoop(std::bind(&TcpConnection::ConnectEstablished, conn));
+    }
 }
 
-void TcpServer::RemoveConnection(const TcpConnectionPtr& conn)
+void TcpServer::RemoveConnection(const TcpConnectionPtr& conn, size_t slot)
 {
     LOG(INFO) << "TcpServer::RemoveConnection [" << m_server_name << "] - connection "
-              << conn->Name();
+              << conn->Id();
     
-    size_t n = m_connections.erase(conn->Name());
-    assert(n == 1); (void) n;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // the destructor may have taken the table already
+    if (slot >= m_connections.size()) return;
+
+    assert(m_connections[slot] == conn);
+    m_connections[slot].reset();
+    m_free_slots.push_back(slot);
+
+    conn->OwnerLoop()->AddConnections(-1);
 }
\ No newline at end of file
@@ -4,12 +4,14 @@
 #include "Callbacks.h"
 #include "InetAddress.h"
 #include "noncopyable.h"
+#include "TcpConnection.h"
 #include "EventLoopThreadPoll.h"
 
-#include <map>
+#include <mutex>
 #include <atomic>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace buzz
 {
@@ -19,12 +21,71 @@ namespace buzz
     class TcpServer : noncopyable
     {
     public:
+        // kAcceptSingle: one listener on the base loop hands connections to
+        // the IO loops round-robin. kAcceptReusePort: every IO loop accepts
+        // on its own SO_REUSEPORT listener and serves what it accepts, the
+        // kernel spreads connections by hash. kAcceptExclusive: every IO loop
+        // watches the one listener with EPOLLEXCLUSIVE and serves what it
+        // accepts, for kernels where reuseport hashing is unwanted
+        enum AcceptMode { kAcceptSingle, kAcceptReusePort, kAcceptExclusive };
+
+        static const size_t kDefaultAcceptBatch = 64;
+
         TcpServer(EventLoop* loop, const std::string& server_name, InetAddress& local_addr,
-                  bool reuse_addr = true);
+                  bool reuse_addr = true, AcceptMode accept_mode = kAcceptSingle);
 
         ~TcpServer();
 
-        void Start(size_t poll_size) { m_event_loop_poll.Start(poll_size); }
+        // policy places the connections of kAcceptSingle on the IO loops, the
+        // other modes serve connections in the loop that accepted them
+        void Start(size_t poll_size,
+                   EventLoopThreadPoll::SelectPolicy policy = EventLoopThreadPoll::kRoundRobin);
+
+        // connections accepted per readiness event of a listener at most, the
+        // rest wait for the next iteration so other events are not starved.
+        // a poller that accepts by itself (io_uring) hands out what it got
+        void SetAcceptBatch(size_t batch) { m_accept_batch = batch > 0 ? batch : 1; }
+
+        // see TcpConnection::SetEdgeTriggered, applies to connections accepted afterwards
+        void SetEdgeTriggered(bool on, size_t read_budget = TcpConnection::kDefaultReadBudget)
+        {
+            m_edge_triggered = on;
+            m_read_budget = read_budget;
+        }
+
+        // see TcpConnection::SetWriteCoalescing, applies to connections accepted afterwards
+        void SetWriteCoalescing(bool on) { m_coalesce_writes = on; }
+
+        // see TcpConnection::SetHighWaterMark, applies to connections accepted afterwards
+        void SetHighWaterMark(size_t high, size_t low, bool pause_reading = false)
+        {
+            m_high_water_mark = high;
+            m_low_water_mark = low;
+            m_pause_on_high_water = pause_reading;
+        }
+
+        // aggregate bytes per second read from and written to all connections
+        // of this server, on top of their own limits. 0 lifts the limit, any
+        // thread, any time. see TcpConnection::SetReadRateLimit
+        void SetReadRateLimit(uint64_t bytes_per_second, uint64_t burst = 0)
+        {
+            m_read_limiter->SetRate(bytes_per_second, burst);
+        }
+
+        void SetWriteRateLimit(uint64_t bytes_per_second, uint64_t burst = 0)
+        {
+            m_write_limiter->SetRate(bytes_per_second, burst);
+        }
+
+        void OnHighWaterMark(const HighWaterMarkEventHandler&& handler)
+        {
+            m_high_water_mark_event_handler = handler;
+        }
+
+        void OnLowWaterMark(const LowWaterMarkEventHandler&& handler)
+        {
+            m_low_water_mark_event_handler = handler;
+        }
 
         void OnError(const ErrorEventHandler&& handler)
         {
@@ -46,26 +107,69 @@ namespace buzz
             m_write_complete_event_handler = handler;
         }
     private:
-        Socket m_sock;
-        
+        // a listening socket watched from one loop. the reserve fd is given up
+        // to accept and drop connections while the process is out of fds,
+        // which would otherwise stay pending and keep the listener readable
+        struct Listener
+        {
+            Listener();
+            ~Listener();
+
+            std::shared_ptr<Socket>  m_sock;
+            std::unique_ptr<Channel> m_channel;
+
+            int m_reserve_fd;
+        };
+
         EventLoop*  m_owner_loop;
         InetAddress m_local_addr;
         std::string m_server_name;
         std::string m_ip_port;
 
+        // shared by the names of the connections, which are built on demand
+        std::shared_ptr<const std::string> m_name_prefix;
+
         std::atomic<uint64_t> m_id;
-        std::unique_ptr<Channel> m_channel;
+
+        bool       m_reuse_addr;
+        AcceptMode m_accept_mode;
+        size_t     m_accept_batch;
+
+        std::shared_ptr<Socket> m_sock;
 
         EventLoopThreadPoll m_event_loop_poll;
 
-        std::map<std::string, TcpConnectionPtr> m_connections;
+        // listeners and connections are added and removed from every loop.
+        // a connection takes a free slot and gives it back when it closes
+        std::mutex                             m_mutex;
+        std::vector<std::shared_ptr<Listener>> m_listeners;
+        std::vector<TcpConnectionPtr>          m_connections;
+        std::vector<size_t>                    m_free_slots;
+
+        bool   m_edge_triggered;
+        size_t m_read_budget;
+        bool   m_coalesce_writes;
+
+        size_t m_high_water_mark;
+        size_t m_low_water_mark;
+        bool   m_pause_on_high_water;
+
+        std::shared_ptr<RateLimiter> m_read_limiter;
+        std::shared_ptr<RateLimiter> m_write_limiter;
         
         ErrorEventHandler         m_error_event_handler;
         MessageEventHandler       m_message_event_handler;
         StateChangeEventHandler   m_state_change_event_handler;
         WriteCompleteEventHandler m_write_complete_event_handler;
+        HighWaterMarkEventHandler m_high_water_mark_event_handler;
+        LowWaterMarkEventHandler  m_low_water_mark_event_handler;
+
+        std::shared_ptr<Socket> OpenListener();
+        void AddListener(const std::shared_ptr<Socket>& sock, EventLoop* loop);
 
-        void NewConnection();
-        void RemoveConnection(const TcpConnectionPtr& conn);
+        void HandleAccept(Listener* listener, EventLoop* loop);
+        void DropConnection(Listener* listener);
+        void NewConnection(int clnt_fd, const InetAddress& peer_addr, EventLoop* loop);
+        void RemoveConnection(const TcpConnectionPtr& conn, size_t slot);
     };
 }
\ No newline at end of file
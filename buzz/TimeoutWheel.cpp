@@ -0,0 +1,74 @@
+#include "EventLoop.h"
+#include "TimeoutWheel.h"
+#include "TcpConnection.h"
+
+#include <algorithm>
+
+using namespace buzz;
+
+TimeoutWheel::TimeoutWheel(EventLoop* loop, double tick)
+    : m_owner_loop(loop),
+    m_tick(static_cast<int64_t>(tick * Timestamp::kMicroSecondsPerSecond)),
+    m_current_tick(0),
+    m_size(0),
+    m_running(false)
+{ }
+
+// the wheel lives as long as its loop, the tick timer goes with the loop's TimerManager
+TimeoutWheel::~TimeoutWheel()
+{ }
+
+void TimeoutWheel::Add(const TcpConnectionPtr& conn, int64_t deadline)
+{
+    if (m_running == false) {
+        m_current_tick = m_owner_loop->Now().MicroSecondsSinceEpoch() / m_tick;
+
+        double interval = static_cast<double>(m_tick) / Timestamp::kMicroSecondsPerSecond;
+        m_timer = m_owner_loop->RunEvery(interval, std::bind(&TimeoutWheel::Tick, this));
+        m_running = true;
+    }
+
+    // farther deadlines wrap to the last bucket and are re-inserted from there
+    int64_t delta = (deadline + m_tick - 1) / m_tick - m_current_tick;
+    delta = std::max<int64_t>(1, std::min<int64_t>(delta, kBuckets - 1));
+
+    m_buckets[(m_current_tick + delta) % kBuckets].push_back(conn);
+    m_size++;
+}
+
+void TimeoutWheel::Tick()
+{
+    int64_t now = m_owner_loop->Now().MicroSecondsSinceEpoch();
+    int64_t target = now / m_tick;
+
+    // a stalled loop catches up at most one full turn
+    if (target - m_current_tick > kBuckets) {
+        m_current_tick = target - kBuckets;
+    }
+
+    while (m_current_tick < target) {
+        m_current_tick++;
+        Expire(m_current_tick % kBuckets, now);
+    }
+
+    if (m_size == 0) {
+        m_owner_loop->Cancel(m_timer);
+        m_running = false;
+    }
+}
+
+void TimeoutWheel::Expire(int bucket, int64_t now)
+{
+    m_expired.swap(m_buckets[bucket]);
+    m_size -= m_expired.size();
+
+    for (auto& it : m_expired) {
+        TcpConnectionPtr conn(it.lock());
+        if (conn == NULL) continue;
+
+        int64_t deadline = conn->CheckTimeout(now);
+        if (deadline >= 0) Add(conn, deadline);
+    }
+
+    m_expired.clear();
+}
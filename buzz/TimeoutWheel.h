@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Timer.h"
+#include "Callbacks.h"
+#include "Timestamp.h"
+#include "noncopyable.h"
+
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace buzz
+{
+    class EventLoop;
+
+    //
+    // coarse per-loop wheel of connection timeouts. a connection sits in at
+    // most one bucket, activity only updates timestamps on the connection and
+    // the bucket is re-checked when its tick comes, so a deadline that moved
+    // later costs one re-insert per tick instead of a timer cancel per read.
+    // timeouts fire up to two ticks late. loop thread only.
+    //
+    class TimeoutWheel : noncopyable
+    {
+    public:
+        static const int kBuckets = 64;
+
+        TimeoutWheel(EventLoop* loop, double tick = 1.0);
+        ~TimeoutWheel();
+
+        // deadline in microseconds on the loop's monotonic clock
+        void Add(const TcpConnectionPtr& conn, int64_t deadline);
+
+        size_t Size() const { return m_size; }
+
+    private:
+        typedef std::vector<std::weak_ptr<TcpConnection>> Bucket;
+
+        EventLoop* m_owner_loop;
+
+        const int64_t m_tick;
+
+        Bucket m_buckets[kBuckets];
+        Bucket m_expired;
+
+        int64_t m_current_tick;
+        size_t  m_size;
+
+        bool    m_running;
+        TimerId m_timer;
+
+        void Tick();
+        void Expire(int bucket, int64_t now);
+    };
+}
@@ -1,64 +1,103 @@
 #include "Timer.h"
 #include "Logger.h"
+#include "Channel.h"
 #include "Timestamp.h"
 #include "EventLoop.h"
+#include "TimerQueue.h"
 
 #include <atomic>
 
+#include <errno.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 using namespace buzz;
 
-class buzz::Timer : noncopyable
+std::atomic<uint64_t> buzz::Timer::m_timer_seq(0);
+
+Timer* TimerPool::Acquire()
 {
-public:
-    Timer(const TaskCallback&& task, const Timestamp when, double interval)
-        : m_seq(m_timer_seq++),
-        m_repeat(interval > 0.0),
-        m_interval(interval),
-        m_expiration(when),
-        m_timer_task_callback(task)
-    { }
-
-    bool Repeat() const { return m_repeat; }
-    Timestamp Expiration() { return m_expiration; }
-
-    void Run() { if (m_timer_task_callback) m_timer_task_callback(); }
-
-    void Restart(Timestamp now)
-    {
-        if (m_repeat) {
-            m_expiration = AddTime(now, m_interval);
-        } else {
-            m_expiration = Timestamp::Invalid();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_free == NULL) {
+        uint32_t base = static_cast<uint32_t>(m_chunks.size()) << kChunkBits;
+
+        Timer* chunk = new Timer[kChunkSize];
+        m_chunks.emplace_back(chunk);
+
+        for (uint32_t i = kChunkSize; i-- > 0; ) {
+            chunk[i].m_index = base + i;
+            chunk[i].m_next = m_free;
+            m_free = &chunk[i];
         }
     }
 
-    uint64_t Sequence() { return m_seq; }
-    
-private:
-    uint64_t m_seq;
+    Timer* timer = m_free;
+    m_free = timer->m_next;
+    timer->m_next = NULL;
 
-    bool   m_repeat;
-    double m_interval;
+    return timer;
+}
 
-    Timestamp    m_expiration;
-    TaskCallback m_timer_task_callback;
-    
+void TimerPool::Release(Timer* timer)
+{
+    // drop the callback outside the lock, it may own arbitrary state
+    TaskCallback().swap(timer->m_timer_task_callback);
 
-    static std::atomic<uint64_t> m_timer_seq;
-};
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-std::atomic<uint64_t> buzz::Timer::m_timer_seq(0);
+    timer->m_generation++;
+    timer->m_next = m_free;
+    m_free = timer;
+}
+
+Timer* TimerPool::Find(uint32_t index, uint32_t generation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t chunk = index >> kChunkBits;
+    if (chunk >= m_chunks.size()) return NULL;
+
+    Timer* timer = &m_chunks[chunk][index & (kChunkSize - 1)];
+
+    return timer->m_generation == generation ? timer : NULL;
+}
+
+TimerQueue* buzz::MakeTimerQueue(TimerQueueType type)
+{
+    if (type == kTimerQueueWheel) {
+        return MakeTimerQueueWheel();
+    }
+
+    return MakeTimerQueueSet();
+}
+
+TimerManager::TimerManager(EventLoop* loop, TimerQueueType type, bool use_timerfd)
+    : m_owner_loop(loop),
+    m_pool(new TimerPool()),
+    m_timers(MakeTimerQueue(type)),
+    m_timerfd(-1),
+    m_armed_deadline(-1),
+    m_expiring(false)
+{
+    if (use_timerfd == false) return;
 
-TimerManager::TimerManager(EventLoop* loop)
-    : m_owner_loop(loop)
-{ }
+    m_timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd == -1) {
+        LOG(FATAL) << "timerfd_create error " << errno << " (" << ::strerror(errno) << ')';
+    }
+
+    m_timer_channel.reset(new Channel(loop, m_timerfd, kReadEvent));
+    m_timer_channel->OnRead(std::bind(&TimerManager::HandleTimerfd, this));
+}
 
 TimerManager::~TimerManager()
 {
-    for (auto it : m_timers) {
-        delete it.second;
+    if (m_timerfd != -1) {
+        m_timer_channel.reset();
+        ::close(m_timerfd);
     }
 }
 
@@ -70,86 +109,132 @@ void TimerManager::Cannel(TimerId timer_id)
 TimerId TimerManager::AddTimer(const TaskCallback&& task, const Timestamp when,
                                double interval)
 {
-    Timer* timer = new Timer(std::move(task), when, interval);
+    Timer* timer = m_pool->Acquire();
+    timer->Init(TaskCallback(task), when, interval);
 
+    TimerId timer_id(timer->Index(), timer->Generation());
     m_owner_loop->RunInLoop(std::bind(&TimerManager::Insert, this, timer));
 
-    return TimerId(timer);
+    return timer_id;
 }
 
 void TimerManager::Schedule()
 {
-    Timestamp now(Timestamp::Now());
-    auto expired = GetExpired(now);
+    Timestamp now(m_owner_loop->Now());
+    m_timers->PopExpired(now, &m_expired);
 
-    for (auto it : expired) {
-        it.second->Run();
+    for (auto it : m_expired) {
+        it->Run();
     }
 
-    Reset(expired, now);
+    Reset(m_expired, now);
+    m_expired.clear();
 }
 
 time_t TimerManager::NearEndTime()
 {
-    Timestamp now(Timestamp::Now());
-
-    auto it = m_timers.begin();
-    if (it == m_timers.end()) return -1;
+    if (UseTimerfd() || m_timers->Empty()) return -1;
 
-    auto t = it->first.MicroSecondsSinceEpoch() - now.MicroSecondsSinceEpoch();
+    // fresh rather than the iteration's cached time, which would lengthen
+    // the timeout by however long this iteration took
+    int64_t t = m_timers->NearEnd(Timestamp::Monotonic());
 
-    return static_cast<time_t>(t < 0 ? 0 : t / 1000);
+    // rounding down would spin on a zero timeout until a sub-millisecond timer is due
+    return static_cast<time_t>(t < 0 ? -1 : (t + 999) / 1000);
 }
 
 void TimerManager::Insert(Timer* timer)
 {
-    Timestamp when(timer->Expiration());
-    
-    auto result = m_timers.insert(std::make_pair(when, timer));
-    assert(result.second); (void) result;
+    if (timer->Canceled()) {
+        m_pool->Release(timer);
+        return;
+    }
 
-    LOG(TRACE) << "add timer " << when.ToString() << " id " << timer->Sequence();
+    m_timers->Insert(timer);
+    if (UseTimerfd() && m_expiring == false) Rearm(false);
+
+    LOG(TRACE) << "add timer " << timer->Expiration().ToString() << " id " << timer->Sequence();
 }
 
 void TimerManager::CannelInLoop(TimerId timer_id)
 {
-    Timer* timer = timer_id.m_timer;
+    Timer* timer = m_pool->Find(timer_id.m_index, timer_id.m_generation);
     if (timer == NULL) return;
 
-    auto it = m_timers.find(std::make_pair(timer->Expiration(), timer));
-    if (it != m_timers.end()) {
-        auto n = m_timers.erase(Entry(it->first, it->second));
-        assert(n == 1); (void) n;
+    LOG(TRACE) << "cannel timer " << timer->Expiration().ToString()
+               << " id " << timer->Sequence();
 
-        delete it->second;
-        LOG(TRACE) << "cannel timer " << timer->Expiration().ToString()
-                   << " id " << timer->Sequence();
+    if (m_timers->Remove(timer)) {
+        m_pool->Release(timer);
+    } else {
+        // popped by the current Schedule or its Insert is still queued,
+        // whichever comes next releases it
+        timer->Cancel();
     }
 }
 
-std::vector<TimerManager::Entry> TimerManager::GetExpired(Timestamp now)
+void TimerManager::HandleTimerfd()
 {
-    Entry entry = std::make_pair(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+    uint64_t expirations = 0;
+    ssize_t n = ::read(m_timerfd, &expirations, sizeof(expirations));
+
+    if (n != sizeof(expirations) && errno != EAGAIN) {
+        LOG(ERROR) << "timerfd read error " << errno << " (" << ::strerror(errno) << ')';
+    }
 
-    auto it = m_timers.lower_bound(entry);
-    assert(it == m_timers.end() || now < it->first);
-    
-    std::vector<Entry> expired;
-    std::copy(m_timers.begin(), it, std::back_inserter(expired));
+    m_armed_deadline = -1;
 
-    m_timers.erase(m_timers.begin(), it);
+    // repeating timers and ones added by the callbacks are inserted while
+    // expiring, the timerfd is armed once for all of them afterwards
+    m_expiring = true;
+    Schedule();
+    m_expiring = false;
 
-    return expired;
+    Rearm(true);
 }
 
-void TimerManager::Reset(std::vector<Entry> expired, Timestamp now)
+// arms the timerfd to the earliest deadline, unless force is false and the
+// armed one is already earlier. a cancelled earliest timer only costs a
+// spurious wakeup, after which the deadline is recomputed
+void TimerManager::Rearm(bool force)
+{
+    Timestamp now(m_owner_loop->Now());
+    int64_t t = m_timers->NearEnd(now);
+
+    int64_t deadline = t < 0 ? -1 : now.MicroSecondsSinceEpoch() + t;
+    if (deadline == m_armed_deadline) return;
+
+    if (force == false && m_armed_deadline != -1 &&
+        (deadline == -1 || m_armed_deadline <= deadline)) {
+        return;
+    }
+
+    struct itimerspec spec;
+    ::memset(&spec, 0, sizeof(spec));
+
+    if (deadline != -1) {
+        // an all-zero it_value would disarm the timer
+        int64_t when = std::max<int64_t>(deadline, 1);
+
+        spec.it_value.tv_sec  = when / Timestamp::kMicroSecondsPerSecond;
+        spec.it_value.tv_nsec = (when % Timestamp::kMicroSecondsPerSecond) * 1000;
+    }
+
+    if (::timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        LOG(ERROR) << "timerfd_settime error " << errno << " (" << ::strerror(errno) << ')';
+    }
+
+    m_armed_deadline = deadline;
+}
+
+void TimerManager::Reset(const std::vector<Timer*>& expired, Timestamp now)
 {
     for (auto it : expired) {
-        if (it.second->Repeat()) {
-            it.second->Restart(now);
-            Insert(it.second);
+        if (it->Repeat()) {
+            it->Restart(now);
+            Insert(it);
         } else {
-            delete it.second;
+            m_pool->Release(it);
         }
     }
-}
\ No newline at end of file
+}
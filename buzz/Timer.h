@@ -3,48 +3,81 @@
 #include "Callbacks.h"
 #include "noncopyable.h"
 
-#include <set>
+#include <memory>
 #include <vector>
 
+#include <stdint.h>
+
 namespace buzz
 {
     class Timer;
+    class Channel;
     class EventLoop;
     class Timestamp;
+    class TimerPool;
+    class TimerQueue;
     class TimerManager;
 
+    // kTimerQueueSet keeps timers ordered in a std::set, kTimerQueueWheel uses
+    // a hierarchical timing wheel with O(1) add and cancel at 1ms resolution
+    enum TimerQueueType { kTimerQueueSet, kTimerQueueWheel };
+
+    // handle to a pooled timer slot, cancelling it once the slot has been
+    // released or reused is a no-op since the generation no longer matches
     class TimerId
     {
     public:
-        TimerId(Timer* timer) : m_timer(timer)
+        TimerId() : m_index(0), m_generation(0)
+        { }
+
+        TimerId(uint32_t index, uint32_t generation)
+            : m_index(index),
+            m_generation(generation)
         { }
 
     private:
         friend class TimerManager;
-        Timer* m_timer;
+
+        uint32_t m_index;
+        uint32_t m_generation;
     };
 
     class TimerManager : noncopyable
     {
     public:
-        TimerManager(EventLoop* loop);
+        // with use_timerfd the earliest deadline is armed on a timerfd channel and
+        // timers run from its read handler instead of after every Poll
+        TimerManager(EventLoop* loop, TimerQueueType type = kTimerQueueSet,
+                     bool use_timerfd = false);
         ~TimerManager();
 
+        bool UseTimerfd() const { return m_timerfd != -1; }
+
         void Cannel(TimerId timer_id);
         TimerId AddTimer(const TaskCallback&& task, const Timestamp when, double interval);
        
         void Schedule();
+
+        // milliseconds until the next timer rounded up, -1 when none or timerfd driven
         time_t NearEndTime();
 
     private:
         EventLoop* m_owner_loop;
 
-        typedef std::pair<Timestamp, Timer*> Entry;
-        std::set<Entry> m_timers;
+        std::unique_ptr<TimerPool>  m_pool;
+        std::unique_ptr<TimerQueue> m_timers;
+        std::vector<Timer*>         m_expired;
+
+        int                      m_timerfd;
+        std::unique_ptr<Channel> m_timer_channel;
+        int64_t                  m_armed_deadline;
+        bool                     m_expiring;
+
+        void HandleTimerfd();
+        void Rearm(bool force);
 
         void Insert(Timer* timer);
         void CannelInLoop(TimerId timer_id);
-        std::vector<Entry> GetExpired(Timestamp now);
-        void Reset(std::vector<Entry> expired, Timestamp now);
+        void Reset(const std::vector<Timer*>& expired, Timestamp now);
     };
 }
\ No newline at end of file
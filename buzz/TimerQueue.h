@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Timer.h"
+#include "Callbacks.h"
+#include "Timestamp.h"
+#include "noncopyable.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace buzz
+{
+    //
+    // timer node, owned by the TimerPool of its TimerManager and recycled
+    // after it fires or is cancelled. the generation changes on every
+    // release, so a stale TimerId no longer matches the slot.
+    //
+    class Timer : noncopyable
+    {
+    public:
+        Timer()
+            : m_prev(NULL),
+            m_next(NULL),
+            m_bucket(-1),
+            m_index(0),
+            m_generation(1),
+            m_seq(0),
+            m_repeat(false),
+            m_canceled(false),
+            m_interval(0.0)
+        { }
+
+        void Init(TaskCallback&& task, const Timestamp when, double interval)
+        {
+            m_seq = m_timer_seq++;
+            m_repeat = interval > 0.0;
+            m_canceled = false;
+            m_interval = interval;
+            m_expiration = when;
+            m_timer_task_callback = std::move(task);
+        }
+
+        bool Repeat() const { return m_repeat && m_canceled == false; }
+        bool Canceled() const { return m_canceled; }
+        Timestamp Expiration() { return m_expiration; }
+
+        void Run() { if (m_timer_task_callback && m_canceled == false) m_timer_task_callback(); }
+
+        // for a timer that is not linked in a queue: not yet inserted, or
+        // popped and waiting to run or be restarted
+        void Cancel() { m_canceled = true; }
+
+        void Restart(Timestamp now)
+        {
+            if (m_repeat) {
+                m_expiration = AddTime(now, m_interval);
+            } else {
+                m_expiration = Timestamp::Invalid();
+            }
+        }
+
+        uint64_t Sequence() { return m_seq; }
+
+        uint32_t Index() const { return m_index; }
+        uint32_t Generation() const { return m_generation; }
+
+        // intrusive hooks owned by the TimerQueue holding this timer,
+        // m_next also links free timers in the TimerPool
+        Timer* m_prev;
+        Timer* m_next;
+        int    m_bucket;
+
+    private:
+        friend class TimerPool;
+
+        uint32_t m_index;
+        uint32_t m_generation;
+
+        uint64_t m_seq;
+
+        bool   m_repeat;
+        bool   m_canceled;
+        double m_interval;
+
+        Timestamp    m_expiration;
+        TaskCallback m_timer_task_callback;
+
+        static std::atomic<uint64_t> m_timer_seq;
+    };
+
+    //
+    // slab of Timer nodes grown in fixed chunks, nodes never move so an index
+    // stays valid for the life of the pool. Acquire may be called from any
+    // thread, Release and Find only from the loop thread.
+    //
+    class TimerPool : noncopyable
+    {
+    public:
+        TimerPool() : m_free(NULL) { }
+
+        Timer* Acquire();
+        void Release(Timer* timer);
+
+        // the live timer for index and generation, NULL if it was released
+        Timer* Find(uint32_t index, uint32_t generation);
+
+    private:
+        static const uint32_t kChunkBits = 8;
+        static const uint32_t kChunkSize = 1 << kChunkBits;
+
+        std::mutex m_mutex;
+
+        std::vector<std::unique_ptr<Timer[]>> m_chunks;
+        Timer* m_free;
+    };
+
+    //
+    // ordered timer storage of a TimerManager, only used in the loop thread.
+    // expirations are on the monotonic clock, see Timestamp::Monotonic.
+    // the queue links the timers inserted into it, their memory stays with the TimerPool.
+    //
+    class TimerQueue : noncopyable
+    {
+    public:
+        TimerQueue() { }
+
+        virtual ~TimerQueue() { }
+
+        virtual void Insert(Timer* timer) = 0;
+        virtual bool Remove(Timer* timer) = 0;
+
+        virtual bool Empty() const = 0;
+
+        // appends the timers due at now to expired, earliest first
+        virtual void PopExpired(Timestamp now, std::vector<Timer*>* expired) = 0;
+
+        // microseconds until the next timer may be due, -1 when empty
+        virtual int64_t NearEnd(Timestamp now) = 0;
+    };
+
+    TimerQueue* MakeTimerQueue(TimerQueueType type);
+
+    TimerQueue* MakeTimerQueueSet();
+    TimerQueue* MakeTimerQueueWheel();
+}
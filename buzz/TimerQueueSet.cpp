@@ -0,0 +1,64 @@
+#include "TimerQueue.h"
+
+#include <set>
+
+#include <assert.h>
+#include <stdint.h>
+
+namespace buzz
+{
+    class TimerQueueSet : public TimerQueue
+    {
+    public:
+        TimerQueueSet() { }
+
+        void Insert(Timer* timer) override;
+        bool Remove(Timer* timer) override;
+
+        bool Empty() const override { return m_timers.empty(); }
+
+        void PopExpired(Timestamp now, std::vector<Timer*>* expired) override;
+        int64_t NearEnd(Timestamp now) override;
+
+    private:
+        typedef std::pair<Timestamp, Timer*> Entry;
+        std::set<Entry> m_timers;
+    };
+
+    void TimerQueueSet::Insert(Timer* timer)
+    {
+        auto result = m_timers.insert(std::make_pair(timer->Expiration(), timer));
+        assert(result.second); (void) result;
+    }
+
+    bool TimerQueueSet::Remove(Timer* timer)
+    {
+        return m_timers.erase(std::make_pair(timer->Expiration(), timer)) == 1;
+    }
+
+    void TimerQueueSet::PopExpired(Timestamp now, std::vector<Timer*>* expired)
+    {
+        Entry entry = std::make_pair(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+
+        auto end = m_timers.lower_bound(entry);
+        assert(end == m_timers.end() || now < end->first);
+
+        for (auto it = m_timers.begin(); it != end; ++it) {
+            expired->push_back(it->second);
+        }
+
+        m_timers.erase(m_timers.begin(), end);
+    }
+
+    int64_t TimerQueueSet::NearEnd(Timestamp now)
+    {
+        auto it = m_timers.begin();
+        if (it == m_timers.end()) return -1;
+
+        int64_t t = it->first.MicroSecondsSinceEpoch() - now.MicroSecondsSinceEpoch();
+
+        return t < 0 ? 0 : t;
+    }
+
+    TimerQueue* MakeTimerQueueSet() { return new TimerQueueSet(); }
+}
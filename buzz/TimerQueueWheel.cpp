@@ -0,0 +1,268 @@
+#include "TimerQueue.h"
+
+#include <algorithm>
+
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+namespace buzz
+{
+    //
+    // hierarchical timing wheel: 4 levels of 256 slots on a 1ms tick cover
+    // 2^32 ms (~49 days), farther timers are parked in the last level and
+    // placed again when it cascades. insert and remove are O(1) through the
+    // intrusive links in Timer, a timer fires on the first tick not earlier
+    // than its expiration.
+    //
+    class TimerQueueWheel : public TimerQueue
+    {
+    public:
+        TimerQueueWheel();
+
+        void Insert(Timer* timer) override;
+        bool Remove(Timer* timer) override;
+
+        bool Empty() const override { return m_size == 0; }
+
+        void PopExpired(Timestamp now, std::vector<Timer*>* expired) override;
+        int64_t NearEnd(Timestamp now) override;
+
+    private:
+        static const int kLevels   = 4;
+        static const int kSlotBits = 8;
+        static const int kSlots    = 1 << kSlotBits;
+        static const int kSlotMask = kSlots - 1;
+
+        // timers already due when inserted
+        static const int kDueBucket = kLevels * kSlots;
+
+        static const int64_t kTickMicroSeconds = 1000;
+
+        // every tick up to and including m_current_tick has been processed
+        uint64_t m_current_tick;
+        size_t   m_size;
+
+        Timer*   m_buckets[kLevels * kSlots + 1];
+        uint64_t m_bitmap[kLevels][kSlots / 64];
+
+        void Place(Timer* timer);
+        void Link(Timer* timer, int bucket);
+        void Unlink(Timer* timer);
+
+        void Cascade(int level, int slot);
+        void Drain(int bucket, std::vector<Timer*>* expired);
+
+        bool LevelEmpty(int level) const;
+        int  NextSlot(int level, int from) const;
+
+        static uint64_t ExpireTick(Timer* timer)
+        {
+            int64_t when = timer->Expiration().MicroSecondsSinceEpoch();
+            return static_cast<uint64_t>((when + kTickMicroSeconds - 1) / kTickMicroSeconds);
+        }
+    };
+
+    TimerQueueWheel::TimerQueueWheel()
+        : m_current_tick(Timestamp::Monotonic().MicroSecondsSinceEpoch() / kTickMicroSeconds),
+        m_size(0)
+    {
+        ::memset(m_buckets, 0, sizeof(m_buckets));
+        ::memset(m_bitmap, 0, sizeof(m_bitmap));
+    }
+
+    void TimerQueueWheel::Insert(Timer* timer)
+    {
+        assert(timer->m_bucket == -1);
+
+        Place(timer);
+        m_size++;
+    }
+
+    bool TimerQueueWheel::Remove(Timer* timer)
+    {
+        if (timer->m_bucket == -1) return false;
+
+        Unlink(timer);
+        m_size--;
+
+        return true;
+    }
+
+    void TimerQueueWheel::PopExpired(Timestamp now, std::vector<Timer*>* expired)
+    {
+        uint64_t target = now.MicroSecondsSinceEpoch() / kTickMicroSeconds;
+
+        Drain(kDueBucket, expired);
+
+        while (m_current_tick < target) {
+            if (m_size == 0) {
+                m_current_tick = target;
+                break;
+            }
+
+            // nothing can fire before the next level 0 wrap, skip to it
+            if (LevelEmpty(0)) {
+                uint64_t last = m_current_tick | kSlotMask;
+                if (last >= target) {
+                    m_current_tick = target;
+                    break;
+                }
+
+                m_current_tick = last;
+            }
+
+            m_current_tick++;
+
+            for (int level = 1; level < kLevels; level++) {
+                int shift = level * kSlotBits;
+                if (m_current_tick & ((1ull << shift) - 1)) break;
+
+                Cascade(level, (m_current_tick >> shift) & kSlotMask);
+            }
+
+            Drain(kDueBucket, expired);
+            Drain(m_current_tick & kSlotMask, expired);
+        }
+    }
+
+    int64_t TimerQueueWheel::NearEnd(Timestamp now)
+    {
+        if (m_size == 0) return -1;
+        if (m_buckets[kDueBucket]) return 0;
+
+        uint64_t next = UINT64_MAX;
+
+        for (int level = 0; level < kLevels; level++) {
+            int shift = level * kSlotBits;
+            uint64_t base = m_current_tick >> shift;
+
+            // a level 0 slot fires at its tick, a higher slot cascades at its start
+            int offset = NextSlot(level, base & kSlotMask);
+            if (offset > 0) {
+                next = std::min(next, (base + offset) << shift);
+            }
+        }
+
+        int64_t t = static_cast<int64_t>(next) * kTickMicroSeconds - now.MicroSecondsSinceEpoch();
+
+        return t < 0 ? 0 : t;
+    }
+
+    void TimerQueueWheel::Place(Timer* timer)
+    {
+        uint64_t expire = ExpireTick(timer);
+
+        if (expire <= m_current_tick) {
+            Link(timer, kDueBucket);
+            return;
+        }
+
+        uint64_t delta = expire - m_current_tick;
+
+        const uint64_t kMaxDelta = (1ull << (kLevels * kSlotBits)) - 1;
+        if (delta > kMaxDelta) {
+            delta = kMaxDelta;
+            expire = m_current_tick + delta;
+        }
+
+        int level = 0;
+        while (delta >> ((level + 1) * kSlotBits)) {
+            level++;
+        }
+
+        int slot = (expire >> (level * kSlotBits)) & kSlotMask;
+        Link(timer, level * kSlots + slot);
+    }
+
+    void TimerQueueWheel::Link(Timer* timer, int bucket)
+    {
+        Timer*& head = m_buckets[bucket];
+
+        timer->m_prev = NULL;
+        timer->m_next = head;
+        timer->m_bucket = bucket;
+
+        if (head) head->m_prev = timer;
+        head = timer;
+
+        if (bucket != kDueBucket) {
+            m_bitmap[bucket / kSlots][(bucket & kSlotMask) >> 6] |= 1ull << (bucket & 63);
+        }
+    }
+
+    void TimerQueueWheel::Unlink(Timer* timer)
+    {
+        int bucket = timer->m_bucket;
+
+        if (timer->m_prev) {
+            timer->m_prev->m_next = timer->m_next;
+        } else {
+            m_buckets[bucket] = timer->m_next;
+        }
+
+        if (timer->m_next) timer->m_next->m_prev = timer->m_prev;
+
+        timer->m_prev = timer->m_next = NULL;
+        timer->m_bucket = -1;
+
+        if (bucket != kDueBucket && m_buckets[bucket] == NULL) {
+            m_bitmap[bucket / kSlots][(bucket & kSlotMask) >> 6] &= ~(1ull << (bucket & 63));
+        }
+    }
+
+    void TimerQueueWheel::Cascade(int level, int slot)
+    {
+        int bucket = level * kSlots + slot;
+
+        Timer* timer = m_buckets[bucket];
+        m_buckets[bucket] = NULL;
+        m_bitmap[level][slot >> 6] &= ~(1ull << (slot & 63));
+
+        while (timer) {
+            Timer* next = timer->m_next;
+            Place(timer);
+            timer = next;
+        }
+    }
+
+    void TimerQueueWheel::Drain(int bucket, std::vector<Timer*>* expired)
+    {
+        while (m_buckets[bucket]) {
+            Timer* timer = m_buckets[bucket];
+
+            Unlink(timer);
+            m_size--;
+
+            expired->push_back(timer);
+        }
+    }
+
+    bool TimerQueueWheel::LevelEmpty(int level) const
+    {
+        for (int i = 0; i < kSlots / 64; i++) {
+            if (m_bitmap[level][i]) return false;
+        }
+
+        return true;
+    }
+
+    // distance (1 .. kSlots) from slot 'from' to the next non-empty slot, -1 if none
+    int TimerQueueWheel::NextSlot(int level, int from) const
+    {
+        for (int k = 1; k <= kSlots; ) {
+            int index = (from + k) & kSlotMask;
+            uint64_t word = m_bitmap[level][index >> 6] >> (index & 63);
+
+            if (word) {
+                return k + __builtin_ctzll(word);
+            }
+
+            k += 64 - (index & 63);
+        }
+
+        return -1;
+    }
+
+    TimerQueue* MakeTimerQueueWheel() { return new TimerQueueWheel(); }
+}
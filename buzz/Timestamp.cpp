@@ -1,5 +1,6 @@
 #include "Timestamp.h"
 
+#include <time.h>
 #include <sys/time.h>
 
 using namespace buzz;
@@ -47,6 +48,14 @@ Timestamp Timestamp::Now()
     return Timestamp(tv.tv_sec * kMicroSecondsPerSecond + tv.tv_usec);
 }
 
+Timestamp Timestamp::Monotonic()
+{
+    struct ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return Timestamp(ts.tv_sec * kMicroSecondsPerSecond + ts.tv_nsec / 1000);
+}
+
 Timestamp Timestamp::Invalid()
 {
     return Timestamp();
@@ -32,7 +32,13 @@ namespace buzz
         std::string ToFormattedString(bool showMicroSecond) const;
         std::string ToFormattedString(const char* fmt = NULL, bool showMicroSecond = true) const;
 
+        // wall clock, for display and for values exchanged with the outside
         static Timestamp Now();
+
+        // CLOCK_MONOTONIC, unaffected by clock steps. only meaningful relative
+        // to other monotonic timestamps, used for timers and timeouts
+        static Timestamp Monotonic();
+
         static Timestamp Invalid();
 
         static const int kMicroSecondsPerSecond = 1000 * 1000;
@@ -0,0 +1,120 @@
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/TcpServer.h>
+#include <buzz/Timestamp.h>
+#include <buzz/InetAddress.h>
+#include <buzz/TcpConnection.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace buzz;
+
+//
+// accept storm: client threads connect and reset in a tight loop while the
+// server accepts with a batch of 1 and then with the given batch, reporting
+// the connections accepted per second. resetting with SO_LINGER 0 keeps the
+// clients' ports out of TIME_WAIT:
+//   accept-bench [port] [client threads] [accept batch] [io threads] [seconds]
+//
+
+static std::atomic<uint64_t> g_accepted(0);
+
+static void OnStateChange(const TcpConnectionPtr& conn)
+{
+    if (conn->GetState() == TcpConnection::kConnected) {
+        g_accepted.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static void RunClients(int port, int clients, double seconds)
+{
+    std::atomic<bool> stop(false);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&] {
+            struct sockaddr_in addr;
+            ::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+            struct linger reset;
+            reset.l_onoff = 1;
+            reset.l_linger = 0;
+
+            while (stop == false) {
+                int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                if (fd == -1) break;
+
+                if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+                    std::cerr << "connect failed: " << ::strerror(errno) << std::endl;
+                    ::close(fd);
+                    break;
+                }
+
+                ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+                ::close(fd);
+            }
+        });
+    }
+
+    ::usleep(static_cast<useconds_t>(seconds * 1000 * 1000));
+    stop = true;
+
+    for (auto& t : threads) t.join();
+}
+
+int main(int argc, char* argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 2010;
+    const int clients = argc > 2 ? atoi(argv[2]) : 8;
+    const size_t batch = argc > 3 ? atoi(argv[3]) : TcpServer::kDefaultAcceptBatch;
+    const size_t io_threads = argc > 4 ? atoi(argv[4]) : 0;
+    const double seconds = argc > 5 ? atof(argv[5]) : 3.0;
+
+    FLAG_SEVERITY = WARN;
+
+    EventLoop loop;
+    InetAddress listen_address(port);
+
+    TcpServer server(&loop, "accept-bench", listen_address);
+    server.OnStateChange(std::bind(&OnStateChange, std::placeholders::_1));
+    server.Start(io_threads);
+
+    std::thread client([&] {
+        const size_t batches[] = { 1, batch };
+
+        for (size_t b : batches) {
+            loop.RunInLoop([&server, b] { server.SetAcceptBatch(b); });
+
+            // connections still being set up from the last run are not counted
+            ::usleep(100 * 1000);
+            g_accepted = 0;
+
+            Timestamp start(Timestamp::Monotonic());
+            RunClients(port, clients, seconds);
+            double elapsed = TimeDifference(Timestamp::Monotonic(), start);
+
+            std::cout << "batch " << b << ": "
+                      << static_cast<uint64_t>(g_accepted / elapsed) << " conn/s" << std::endl;
+        }
+
+        loop.Exit();
+    });
+
+    loop.Loop();
+    client.join();
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/TcpServer.h>
+#include <buzz/Timestamp.h>
+#include <buzz/InetAddress.h>
+#include <buzz/TcpConnection.h>
+
+#include <new>
+#include <atomic>
+#include <thread>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace buzz;
+
+//
+// connect/disconnect churn: a client opens and closes connections one
+// after another, the server accepts them and tears them down in its loop
+// thread. reports connections per second and the heap allocations the
+// loop thread makes per connection, counted after a warm-up so cached
+// blocks are in steady state. every connection copies the server's
+// handlers, a plain function is copied without allocating while a
+// std::bind result takes one allocation per copy. logging is limited to
+// warnings so the count is the library's own, at the default severity
+// every accept and close writes log lines that allocate:
+//   churn-bench [port] [connections] [warm-up connections]
+//
+
+// operator new is replaced to count the allocations of the loop thread
+static thread_local bool t_count_allocations = false;
+static std::atomic<uint64_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+    if (t_count_allocations) g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    void* p = ::malloc(size > 0 ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    ::free(p);
+}
+
+static std::atomic<uint64_t> g_closed(0);
+
+static void OnStateChange(const TcpConnectionPtr& conn)
+{
+    if (conn->GetState() == TcpConnection::kDisconnected) {
+        g_closed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static void Churn(int port, uint64_t connections)
+{
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    uint64_t target = g_closed + connections;
+
+    for (uint64_t i = 0; i < connections; i++) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+        if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+            std::cerr << "connect failed: " << ::strerror(errno) << std::endl;
+            ::close(fd);
+            ::exit(1);
+        }
+
+        ::close(fd);
+    }
+
+    while (g_closed < target) ::usleep(1000);
+}
+
+int main(int argc, char* argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 2010;
+    const uint64_t connections = argc > 2 ? atoll(argv[2]) : 10000;
+    const uint64_t warm_up = argc > 3 ? atoll(argv[3]) : 1000;
+
+    FLAG_SEVERITY = WARN;
+
+    EventLoop loop;
+    InetAddress listen_address(port);
+
+    TcpServer server(&loop, "churn-bench", listen_address);
+    server.OnStateChange(&OnStateChange);
+    server.Start(0);
+
+    std::thread client([&] {
+        Churn(port, warm_up);
+
+        loop.RunInLoop([] { g_allocations = 0; });
+
+        Timestamp start(Timestamp::Monotonic());
+        Churn(port, connections);
+        double elapsed = TimeDifference(Timestamp::Monotonic(), start);
+
+        std::cout << static_cast<uint64_t>(connections / elapsed) << " conn/s, "
+                  << static_cast<double>(g_allocations) / connections
+                  << " allocations per connection" << std::endl;
+
+        loop.Exit();
+    });
+
+    // main is the loop thread
+    t_count_allocations = true;
+    loop.Loop();
+    client.join();
+
+    return 0;
+}
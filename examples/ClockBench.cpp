@@ -0,0 +1,78 @@
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/Timestamp.h>
+
+#include <iostream>
+#include <functional>
+
+#include <stdlib.h>
+
+using namespace buzz;
+
+//
+// cost of the clocks an EventLoop iteration can read: the wall clock
+// (gettimeofday), the monotonic clock (clock_gettime, vDSO) and the
+// per-iteration cached EventLoop::Now(). then runs empty loop iterations
+// to put the per-iteration clock cost next to the iteration cost.
+//
+// clock-bench [calls] [iterations]
+//
+int main(int argc, char* argv[])
+{
+    FLAG_SEVERITY = WARN;
+
+    const int kCalls = argc > 1 ? atoi(argv[1]) : 10000000;
+    const int kIterations = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    EventLoop loop;
+    int64_t sink = 0;
+
+    Timestamp start(Timestamp::Monotonic());
+    for (int i = 0; i < kCalls; i++) {
+        sink += Timestamp::Now().MicroSecondsSinceEpoch();
+    }
+    double wall = TimeDifference(Timestamp::Monotonic(), start) * 1e9 / kCalls;
+
+    start = Timestamp::Monotonic();
+    for (int i = 0; i < kCalls; i++) {
+        sink += Timestamp::Monotonic().MicroSecondsSinceEpoch();
+    }
+    double monotonic = TimeDifference(Timestamp::Monotonic(), start) * 1e9 / kCalls;
+
+    start = Timestamp::Monotonic();
+    for (int i = 0; i < kCalls; i++) {
+        sink += loop.Now().MicroSecondsSinceEpoch();
+        __asm__ __volatile__("" ::: "memory");
+    }
+    double cached = TimeDifference(Timestamp::Monotonic(), start) * 1e9 / kCalls;
+
+    // each task queues the next one, so every task costs one loop iteration
+    int done = 0;
+    std::function<void()> next = [&] {
+        if (++done == kIterations) {
+            loop.Exit();
+        } else {
+            loop.QueueInLoop([&] { next(); });
+        }
+    };
+
+    loop.QueueInLoop([&] { next(); });
+
+    start = Timestamp::Monotonic();
+    loop.Loop();
+    double iteration = TimeDifference(Timestamp::Monotonic(), start) * 1e9 / kIterations;
+
+    std::cout << "Timestamp::Now (gettimeofday):     " << wall << " ns" << std::endl;
+    std::cout << "Timestamp::Monotonic (vDSO):       " << monotonic << " ns" << std::endl;
+    std::cout << "EventLoop::Now (cached):           " << cached << " ns" << std::endl;
+    std::cout << "loop iteration:                    " << iteration << " ns" << std::endl;
+
+    // an iteration used to read the wall clock in Poll, NearEndTime and
+    // Schedule; it now reads the monotonic clock once, plus once in
+    // NearEndTime while timers are pending without timerfd
+    std::cout << "clock cost per iteration: before " << 3 * wall << " ns, now "
+              << monotonic << " ns (" << 2 * monotonic << " ns with pending timers)"
+              << std::endl;
+
+    return sink == 42;
+}
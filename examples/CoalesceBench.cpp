@@ -0,0 +1,192 @@
+#include <buzz/Buffer.h>
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/TcpServer.h>
+#include <buzz/Timestamp.h>
+#include <buzz/InetAddress.h>
+#include <buzz/TcpConnection.h>
+
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/syscall.h>
+
+using namespace buzz;
+
+//
+// pipelined echo where every request is answered with a header, the body
+// and a trailer in three sends: written immediately with Nagle on, written
+// immediately with TCP_NODELAY, and coalesced. reports the write syscalls
+// the server thread makes per message. with Nagle the small second and
+// third writes wait for the client's delayed ack:
+//   coalesce-bench [port] [connections] [message size] [pipeline depth] [seconds]
+//
+
+// write and writev are wrapped to count the calls made by the server loop
+// thread, the clients and iostream go through them too but are not counted
+static thread_local bool t_count_writes = false;
+static std::atomic<uint64_t> g_write_calls(0);
+
+extern "C" ssize_t write(int fd, const void* buf, size_t count)
+{
+    if (t_count_writes) g_write_calls.fetch_add(1, std::memory_order_relaxed);
+    return ::syscall(SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec* iov, int iovcnt)
+{
+    if (t_count_writes) g_write_calls.fetch_add(1, std::memory_order_relaxed);
+    return ::syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+enum Mode { kImmediate, kImmediateNoDelay, kCoalesced };
+
+static const char* const kModeNames[] = {
+    "immediate:          ", "immediate, nodelay: ", "coalesced:          "
+};
+
+static size_t g_msg_size = 0;
+static Mode   g_mode = kImmediate;
+
+static const char kHeader[] = "HDR:";
+static const char kTrailer[] = "\r\n";
+
+static const size_t kHeaderSize = sizeof(kHeader) - 1;
+static const size_t kTrailerSize = sizeof(kTrailer) - 1;
+
+static void OnStateChange(const TcpConnectionPtr& conn)
+{
+    if (conn->GetState() == TcpConnection::kConnected) {
+        conn->SetTcpNoDelay(g_mode != kImmediate);
+        conn->SetWriteCoalescing(g_mode == kCoalesced);
+    }
+}
+
+static void OnMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp)
+{
+    while (buffer->ReadableBytes() >= g_msg_size) {
+        conn->SendMessage(kHeader, kHeaderSize);
+        conn->SendMessage(buffer->Peek(), g_msg_size);
+        conn->SendMessage(kTrailer, kTrailerSize);
+
+        buffer->Retrieve(g_msg_size);
+    }
+}
+
+static uint64_t RunClients(int port, int connections, int depth, double seconds)
+{
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> messages(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < connections; i++) {
+        threads.emplace_back([&] {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+            struct sockaddr_in addr;
+            ::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+            if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+                std::cerr << "connect failed: " << ::strerror(errno) << std::endl;
+                ::close(fd);
+                return;
+            }
+
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            std::string request(g_msg_size * depth, 'x');
+            std::vector<char> response((kHeaderSize + g_msg_size + kTrailerSize) * depth);
+
+            uint64_t done = 0;
+            while (stop == false) {
+                if (::write(fd, request.data(), request.size()) !=
+                    static_cast<ssize_t>(request.size())) {
+                    break;
+                }
+
+                size_t nread = 0;
+                while (nread < response.size()) {
+                    ssize_t n = ::read(fd, response.data() + nread, response.size() - nread);
+                    if (n <= 0) break;
+                    nread += n;
+                }
+
+                if (nread < response.size()) break;
+                done += depth;
+            }
+
+            messages += done;
+            ::close(fd);
+        });
+    }
+
+    ::usleep(static_cast<useconds_t>(seconds * 1000 * 1000));
+    stop = true;
+
+    for (auto& t : threads) t.join();
+
+    return messages;
+}
+
+int main(int argc, char* argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 2010;
+    const int connections = argc > 2 ? atoi(argv[2]) : 16;
+    g_msg_size = argc > 3 ? atoi(argv[3]) : 64;
+    const int depth = argc > 4 ? atoi(argv[4]) : 16;
+    const double seconds = argc > 5 ? atof(argv[5]) : 3.0;
+
+    FLAG_SEVERITY = WARN;
+
+    EventLoop loop;
+    InetAddress listen_address(port);
+
+    TcpServer server(&loop, "coalesce-bench", listen_address);
+    server.OnStateChange(std::bind(&OnStateChange, std::placeholders::_1));
+    server.OnMessage(std::bind(&OnMessage, std::placeholders::_1,
+                               std::placeholders::_2, std::placeholders::_3));
+    server.Start(0);
+
+    std::thread client([&] {
+        for (int mode = kImmediate; mode <= kCoalesced; mode++) {
+            loop.RunInLoop([&] { g_mode = static_cast<Mode>(mode); g_write_calls = 0; });
+
+            Timestamp start(Timestamp::Monotonic());
+            uint64_t messages = RunClients(port, connections, depth, seconds);
+            double elapsed = TimeDifference(Timestamp::Monotonic(), start);
+
+            // let the loop drop the closed connections before sampling
+            ::usleep(100 * 1000);
+
+            std::cout << kModeNames[mode]
+                      << static_cast<uint64_t>(messages / elapsed) << " msg/s, "
+                      << static_cast<double>(g_write_calls) / std::max<uint64_t>(messages, 1)
+                      << " write syscalls per message" << std::endl;
+        }
+
+        loop.Exit();
+    });
+
+    // main is the loop thread
+    t_count_writes = true;
+    loop.Loop();
+    client.join();
+
+    return 0;
+}
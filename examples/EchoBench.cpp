@@ -0,0 +1,109 @@
+#include <buzz/Timestamp.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace buzz;
+
+//
+// echo load generator, run against echo-server in each mode and compare:
+//   echo-server 2007 1      &&  echo-bench 127.0.0.1 2007
+//   echo-server 2007 1 et   &&  echo-bench 127.0.0.1 2007
+//   echo-server 2007 1 coalesce  &&  echo-bench 127.0.0.1 2007 16 64 16
+//
+// and the pollers against each other, io_uring accepts and receives with
+// multishot requests instead of a read per readiness event:
+//   BUZZ_POLLER=epoll echo-server 2007 1  &&  echo-bench 127.0.0.1 2007 16 64
+//   BUZZ_POLLER=uring echo-server 2007 1  &&  echo-bench 127.0.0.1 2007 16 64
+//
+// echo-bench <ip> <port> [connections] [message size] [pipeline depth] [seconds]
+//
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0]
+                  << " <ip> <port> [connections] [message size] [pipeline depth] [seconds]"
+                  << std::endl;
+        return 1;
+    }
+
+    const char* ip = argv[1];
+    const int port = atoi(argv[2]);
+    const int connections = argc > 3 ? atoi(argv[3]) : 16;
+    const size_t msg_size = argc > 4 ? atoi(argv[4]) : 4096;
+    const int depth = argc > 5 ? atoi(argv[5]) : 1;
+    const double seconds = argc > 6 ? atof(argv[6]) : 5.0;
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> messages(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < connections; i++) {
+        threads.emplace_back([&] {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+            struct sockaddr_in addr;
+            ::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            ::inet_pton(AF_INET, ip, &addr.sin_addr);
+
+            if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+                std::cerr << "connect failed: " << ::strerror(errno) << std::endl;
+                ::close(fd);
+                return;
+            }
+
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            std::string request(msg_size * depth, 'x');
+            std::vector<char> response(request.size());
+
+            uint64_t done = 0;
+            while (stop == false) {
+                if (::write(fd, request.data(), request.size()) !=
+                    static_cast<ssize_t>(request.size())) {
+                    break;
+                }
+
+                size_t nread = 0;
+                while (nread < response.size()) {
+                    ssize_t n = ::read(fd, response.data() + nread, response.size() - nread);
+                    if (n <= 0) break;
+                    nread += n;
+                }
+
+                if (nread < response.size()) break;
+                done += depth;
+            }
+
+            messages += done;
+            ::close(fd);
+        });
+    }
+
+    Timestamp start(Timestamp::Now());
+    ::usleep(static_cast<useconds_t>(seconds * 1000 * 1000));
+    stop = true;
+
+    for (auto& t : threads) t.join();
+    double elapsed = TimeDifference(Timestamp::Now(), start);
+
+    std::cout << connections << " connections, " << msg_size << " byte messages, depth "
+              << depth << ": " << static_cast<uint64_t>(messages / elapsed) << " msg/s, "
+              << messages * msg_size / elapsed / (1024 * 1024) << " MiB/s" << std::endl;
+
+    return 0;
+}
@@ -7,11 +7,16 @@
 
 #include <iostream>
 
+#include <stdlib.h>
+#include <string.h>
+
 class EchoServer
 {
 public:
-    EchoServer(buzz::EventLoop* loop, buzz::InetAddress& host, int work_threads = 0)
-        : m_server(loop, "echo-serve", host), m_work_threads(work_threads)
+    EchoServer(buzz::EventLoop* loop, buzz::InetAddress& host, int work_threads = 0,
+               buzz::TcpServer::AcceptMode accept_mode = buzz::TcpServer::kAcceptSingle)
+        : m_server(loop, "echo-serve", host, true, accept_mode), m_work_threads(work_threads),
+        m_policy(buzz::EventLoopThreadPoll::kRoundRobin)
     {
         using namespace std::placeholders;
 
@@ -19,9 +24,13 @@ public:
         m_server.OnMessage(std::bind(&EchoServer::OnMessage, this, _1, _2, _3));
     }
 
+    void SetEdgeTriggered(bool on) { m_server.SetEdgeTriggered(on); }
+    void SetWriteCoalescing(bool on) { m_server.SetWriteCoalescing(on); }
+    void SetSelectPolicy(buzz::EventLoopThreadPoll::SelectPolicy policy) { m_policy = policy; }
+
     void Start()
     {
-        m_server.Start(m_work_threads);
+        m_server.Start(m_work_threads, m_policy);
     }
 
     void OnSateChange(const buzz::TcpConnectionPtr& conn)
@@ -41,15 +50,40 @@ public:
 private:
     buzz::TcpServer m_server;
     int       m_work_threads;
+
+    buzz::EventLoopThreadPoll::SelectPolicy m_policy;
 };
 
-int main()
+// echo-server [port] [work threads] [et] [coalesce] [reuseport | exclusive]
+//             [least-connections | least-busy | two-choices]
+int main(int argc, char* argv[])
 {
+    unsigned short port = argc > 1 ? atoi(argv[1]) : 7;
+    int work_threads = argc > 2 ? atoi(argv[2]) : 1;
+
+    bool edge_triggered = false;
+    bool coalesce_writes = false;
+    buzz::TcpServer::AcceptMode accept_mode = buzz::TcpServer::kAcceptSingle;
+    buzz::EventLoopThreadPoll::SelectPolicy policy = buzz::EventLoopThreadPoll::kRoundRobin;
+
+    for (int i = 3; i < argc; i++) {
+        if (::strcmp(argv[i], "et") == 0) edge_triggered = true;
+        if (::strcmp(argv[i], "coalesce") == 0) coalesce_writes = true;
+        if (::strcmp(argv[i], "reuseport") == 0) accept_mode = buzz::TcpServer::kAcceptReusePort;
+        if (::strcmp(argv[i], "exclusive") == 0) accept_mode = buzz::TcpServer::kAcceptExclusive;
+        if (::strcmp(argv[i], "least-connections") == 0) policy = buzz::EventLoopThreadPoll::kLeastConnections;
+        if (::strcmp(argv[i], "least-busy") == 0) policy = buzz::EventLoopThreadPoll::kLeastBusy;
+        if (::strcmp(argv[i], "two-choices") == 0) policy = buzz::EventLoopThreadPoll::kPowerOfTwoChoices;
+    }
+
     buzz::EventLoop loop;
     buzz::Signal::Register(SIGINT, [&]() { loop.Exit(); });
 
-    buzz::InetAddress listen_address(7);
-    EchoServer echo_server(&loop, listen_address, 1);
+    buzz::InetAddress listen_address(port);
+    EchoServer echo_server(&loop, listen_address, work_threads, accept_mode);
+    echo_server.SetEdgeTriggered(edge_triggered);
+    echo_server.SetWriteCoalescing(coalesce_writes);
+    echo_server.SetSelectPolicy(policy);
     echo_server.Start();
 
     loop.Loop();
@@ -0,0 +1,49 @@
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/Timestamp.h>
+
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+
+using namespace buzz;
+
+// cross-thread EventLoop::RunInLoop throughput with 1 - 32 producer threads
+int main(int argc, char* argv[])
+{
+    FLAG_SEVERITY = WARN;
+
+    const uint64_t kPosts = argc > 1 ? atoll(argv[1]) : 1000000;
+
+    for (int producers = 1; producers <= 32; producers <<= 1) {
+        EventLoop loop;
+
+        const uint64_t per_thread = kPosts / producers;
+        const uint64_t total = per_thread * producers;
+        uint64_t done = 0;
+
+        Timestamp start(Timestamp::Now());
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producers; i++) {
+            threads.emplace_back([&] {
+                for (uint64_t n = 0; n < per_thread; n++) {
+                    loop.RunInLoop([&] { if (++done == total) loop.Exit(); });
+                }
+            });
+        }
+
+        loop.Loop();
+
+        double seconds = TimeDifference(Timestamp::Now(), start);
+        for (auto& t : threads) t.join();
+
+        std::cout << producers << " producers: " << total << " posts in " << seconds
+                  << "s, " << static_cast<uint64_t>(total / seconds) << " posts/s, "
+                  << loop.WakeupsSaved() << " wakeup syscalls saved" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/Timestamp.h>
+
+#include <random>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+
+using namespace buzz;
+
+// add / cancel / expire cost of the std::set and timing wheel TimerManager backends
+int main(int argc, char* argv[])
+{
+    FLAG_SEVERITY = WARN;
+
+    const int kTimers = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    const char* names[] = { "set", "wheel" };
+    TimerQueueType types[] = { kTimerQueueSet, kTimerQueueWheel };
+
+    for (int i = 0; i < 2; i++) {
+        EventLoopOptions options;
+        options.timer_queue_type = types[i];
+
+        EventLoop loop(options);
+
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> far(1.0, 3600.0);
+        std::uniform_real_distribution<double> near(0.0, 0.1);
+
+        std::vector<TimerId> ids;
+        ids.reserve(kTimers);
+
+        Timestamp start(Timestamp::Now());
+        for (int n = 0; n < kTimers; n++) {
+            ids.push_back(loop.RunAfter(far(rng), [] { }));
+        }
+        double add = TimeDifference(Timestamp::Now(), start);
+
+        start = Timestamp::Now();
+        for (int n = 0; n < kTimers; n++) {
+            loop.Cancel(ids[n]);
+        }
+        double cancel = TimeDifference(Timestamp::Now(), start);
+
+        int fired = 0;
+        for (int n = 0; n < kTimers; n++) {
+            loop.RunAfter(near(rng), [&] { if (++fired == kTimers) loop.Exit(); });
+        }
+
+        start = Timestamp::Now();
+        loop.Loop();
+        double expire = TimeDifference(Timestamp::Now(), start);
+
+        std::cout << names[i] << ": add " << add * 1e9 / kTimers << " ns, cancel "
+                  << cancel * 1e9 / kTimers << " ns, " << kTimers
+                  << " timers within 100ms expired in " << expire * 1e3 << " ms" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <buzz/Buffer.h>
+#include <buzz/Slice.h>
+#include <buzz/Logger.h>
+#include <buzz/EventLoop.h>
+#include <buzz/TcpServer.h>
+#include <buzz/Timestamp.h>
+#include <buzz/InetAddress.h>
+#include <buzz/TcpConnection.h>
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace buzz;
+
+//
+// owned sends with and without MSG_ZEROCOPY across payload sizes. every
+// request byte makes the server queue a burst of shared payloads by
+// reference, the client reads and discards them:
+//   zerocopy-bench [port] [seconds per run] [burst bytes]
+//
+// on loopback the kernel copies zerocopy payloads anyway (the completion is
+// flagged as copied), so there the runs only show the pinning and completion
+// overhead. measure over a real NIC to see where zerocopy starts to win,
+// typically somewhere past 10-32KiB per send.
+//
+
+static std::atomic<size_t> g_payload_size(0);
+static std::atomic<size_t> g_threshold(0);
+static std::atomic<size_t> g_burst(0);
+
+static void OnStateChange(const TcpConnectionPtr& conn)
+{
+    if (conn->GetState() == TcpConnection::kConnected) {
+        conn->SetZeroCopyThreshold(g_threshold);
+    }
+}
+
+static void OnMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp)
+{
+    size_t requests = buffer->ReadableBytes();
+    buffer->RetrieveAll();
+
+    size_t size = g_payload_size;
+    size_t count = std::max<size_t>(g_burst / size, 1);
+
+    // one fresh payload per burst, shared by its sends and kept alive by them
+    std::shared_ptr<std::string> payload(new std::string(size, 'z'));
+
+    for (size_t i = 0; i < requests * count; i++) {
+        conn->SendMessage(Slice(payload->data(), payload->size(), payload));
+    }
+}
+
+static double RunClient(int port, size_t size, double seconds)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::cerr << "connect failed: " << ::strerror(errno) << std::endl;
+        ::close(fd);
+        return 0.0;
+    }
+
+    size_t burst = std::max<size_t>(g_burst / size, 1) * size;
+    std::vector<char> sink(256 * 1024);
+
+    uint64_t received = 0;
+    Timestamp start(Timestamp::Monotonic());
+
+    while (TimeDifference(Timestamp::Monotonic(), start) < seconds) {
+        if (::write(fd, "x", 1) != 1) break;
+
+        size_t nread = 0;
+        while (nread < burst) {
+            ssize_t n = ::read(fd, sink.data(), std::min(sink.size(), burst - nread));
+            if (n <= 0) break;
+            nread += n;
+        }
+
+        if (nread < burst) break;
+        received += nread;
+    }
+
+    double elapsed = TimeDifference(Timestamp::Monotonic(), start);
+    ::close(fd);
+
+    return received / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char* argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 2009;
+    const double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+    g_burst = argc > 3 ? atoi(argv[3]) : 4 * 1024 * 1024;
+
+    FLAG_SEVERITY = WARN;
+
+    EventLoop loop;
+    InetAddress listen_address(port);
+
+    TcpServer server(&loop, "zerocopy-bench", listen_address);
+    server.OnStateChange(std::bind(&OnStateChange, std::placeholders::_1));
+    server.OnMessage(std::bind(&OnMessage, std::placeholders::_1,
+                               std::placeholders::_2, std::placeholders::_3));
+    server.Start(0);
+
+    std::thread client([&] {
+        const size_t sizes[] = { 4096, 16384, 65536, 262144, 1048576, 4194304 };
+
+        for (size_t size : sizes) {
+            g_payload_size = size;
+
+            g_threshold = 0;
+            double copied = RunClient(port, size, seconds);
+
+            g_threshold = 1;
+            double zerocopy = RunClient(port, size, seconds);
+
+            std::cout << size << " byte sends: copy " << copied << " MiB/s, zerocopy "
+                      << zerocopy << " MiB/s" << std::endl;
+        }
+
+        loop.Exit();
+    });
+
+    loop.Loop();
+    client.join();
+
+    return 0;
+}